@@ -1,14 +1,26 @@
 #include "NeZcab.h"
 #include "IPlug_include_in_plug_src.h"
+#include "IPlugPaths.h"
+#include <algorithm>
 #include <string>
 
 NeZcab::NeZcab(const InstanceInfo& info)
     : iplug::Plugin(info, MakeConfig(kNumParams, kNumPresets)),
     irBuffer(GetSampleRate())
 {
+    irBuffer.SetBuilder([this](const IrBuffer::IrSamples& ir, double sampleRate) { BuildIr(ir, sampleRate); });
+
     GetParam(kParamGain)->InitDouble("Gain", 100., 0., 120.0, 0.01, "%");
-    GetParam(kParamResample)->InitEnum("ResampleType", 1, 4, "", 0, "", "WDL Resampler", "Custom Resampler", "Linear Resampler", "R8Brain Resampler");
+    GetParam(kParamResample)->InitEnum("ResampleType", 1, 5, "", 0, "", "WDL Resampler", "Custom Resampler", "Linear Resampler", "R8Brain Resampler", "Custom HQ Resampler");
+    GetParam(kParamMultirate)->InitBool("Reduced rate", false, "", IParam::kFlagCannotAutomate);
 
+#if defined(USE_AUTO_CONVOLVER)
+    // Tuning results are per machine, every instance shares them
+    WDL_String profileDir;
+    AppSupportPath(profileDir);
+    profileDir.Append("/NeZcab");
+    ConvolverTuner::Get()->SetProfileDirectory(profileDir.Get());
+#endif
 
 #if IPLUG_EDITOR // http://bit.ly/2S64BDd
     mMakeGraphicsFunc = [&]() {
@@ -35,13 +47,84 @@ NeZcab::NeZcab(const InstanceInfo& info)
             WDL_String filePath;
             WDL_String dirPath;
             IRECT bounds = pControl->GetRECT();
-            GetUI()->PromptForFile(filePath, dirPath, EFileAction::Open, "wav");
+            GetUI()->PromptForFile(filePath, dirPath, EFileAction::Open, "wav nzir");
 
+            // Loads on the IR worker, OnIdle shows any error
             irBuffer.LoadIr(filePath, dirPath);
         };
         pGraphics->AttachControl(new IVButtonControl(IRECT(0, 0, 75, 25), loadHandler, "Load"));
 
         pGraphics->AttachControl(new ICaptionControl(IRECT(0, 30, 150, 55), kParamResample, IText(16.f), DEFAULT_FGCOLOR, false));
+        pGraphics->AttachControl(new IVToggleControl(IRECT(0, 60, 150, 85), kParamMultirate, "Reduced rate"));
+
+#if defined(NEZCAB_BENCHMARKS)
+        // Runs synchronously on the UI thread, the report is written next to the chosen IR
+        auto benchmarkHandler = [&](IControl* pControl) {
+            WDL_String filePath;
+            WDL_String dirPath;
+            GetUI()->PromptForFile(filePath, dirPath, EFileAction::Open, "wav");
+
+            ResamplerBenchmark benchmark;
+            if (filePath.GetLength() > 0) {
+                benchmark.AddFile(filePath.Get());
+            }
+            const std::string report = benchmark.Run();
+            DBGMSG("%s", report.c_str());
+
+            if (filePath.GetLength() > 0) {
+                WDL_String reportPath(filePath);
+                reportPath.Append(".resampler-benchmark.txt");
+                if (FILE* f = fopen(reportPath.Get(), "w")) {
+                    fputs(report.c_str(), f);
+                    fclose(f);
+                }
+            }
+        };
+        pGraphics->AttachControl(new IVButtonControl(IRECT(80, 0, 155, 25), benchmarkHandler, "Res bench"));
+
+        // Synthetic IRs only, the report goes where the prompt says
+        auto convolverBenchmarkHandler = [&](IControl* pControl) {
+            WDL_String filePath;
+            WDL_String dirPath;
+            GetUI()->PromptForFile(filePath, dirPath, EFileAction::Save, "txt");
+
+            const std::string report = ConvolverBenchmark().Run();
+            DBGMSG("%s", report.c_str());
+
+            if (filePath.GetLength() > 0) {
+                if (FILE* f = fopen(filePath.Get(), "w")) {
+                    fputs(report.c_str(), f);
+                    fclose(f);
+                }
+            }
+        };
+        pGraphics->AttachControl(new IVButtonControl(IRECT(160, 0, 235, 25), convolverBenchmarkHandler, "Conv bench"));
+
+        // Writes <name>.<rate>.nzir next to every wav in the folder, with the current resampler
+        auto convertHandler = [&](IControl* pControl) {
+            WDL_String dirPath;
+            GetUI()->PromptForDirectory(dirPath);
+            if (dirPath.GetLength() == 0) { return; }
+
+            IrConverter converter;
+            converter.SetResampler((IrBuffer::ResamplerType)GetParam(kParamResample)->Int());
+            int failures = converter.Run(dirPath.Get());
+            DBGMSG("%s", converter.GetReport().c_str());
+            GetUI()->ShowMessageBox(failures == 0 ? "All IRs converted" : "Some IRs failed, see the debug output", "IR converter", kMB_OK);
+        };
+        pGraphics->AttachControl(new IVButtonControl(IRECT(320, 0, 395, 25), convertHandler, "Convert"));
+#endif
+#if defined(NEZCAB_TRACE)
+        auto traceHandler = [&](IControl* pControl) {
+            WDL_String filePath;
+            WDL_String dirPath;
+            GetUI()->PromptForFile(filePath, dirPath, EFileAction::Save, "json");
+            if (filePath.GetLength() > 0) {
+                Trace::Write(filePath.Get());
+            }
+        };
+        pGraphics->AttachControl(new IVButtonControl(IRECT(240, 0, 315, 25), traceHandler, "Trace"));
+#endif
         };
 #endif
 }
@@ -49,57 +132,218 @@ NeZcab::NeZcab(const InstanceInfo& info)
 #if IPLUG_DSP
 void NeZcab::ProcessBlock(sample** inputs, sample** outputs, int nFrames)
 {
+    TRACE_SCOPE("NeZcab::ProcessBlock");
+    // The host's mode is restored on return
+    DenormalGuard denormalGuard;
     const double gain = GetParam(kParamGain)->Value() / 100.;
     //const int nChansIn = NInChansConnected();
     const int nChans = NOutChansConnected();
 
-    convolutionDsp[0].process(inputs, outputs, nFrames);
-    sample** inR = inputs + 1;
-    sample** outR = outputs + 1;
-    convolutionDsp[1].process(inR, outR, nFrames);
+    // Leaving offline rendering without a reset falls straight back to the realtime convolvers
+    if (mIsOffline && GetRenderingOffline()) {
+        Convolve(offlineDsp, inputs, outputs, nFrames);
+    }
+    else {
+        Convolve(convolutionDsp, inputs, outputs, nFrames);
+    }
 
     mMeterSender.ProcessBlock(outputs, nFrames, kCtrlTagMeter);
 }
 
 void NeZcab::OnIdle() {
     mMeterSender.TransmitData(*this);
+
+    // Some hosts leave offline rendering without a reset. ProcessBlock is
+    // back on the realtime convolvers already, they still hold the input
+    // from before the render and the host still has the offline latency.
+    if (mIsOffline && !GetRenderingOffline()) {
+        mIsOffline = false;
+        ResetRealtime();
+        UpdateLatency();
+    }
     
-    if (irBuffer.mIsStaged) {
-#if defined(USE_WDL_CONVOLVER)
-        convolutionDsp[0].SetIr(irBuffer.Get(), irBuffer.GetSize(), GetSampleRate(), GetBlockSize());
-        convolutionDsp[1].SetIr(irBuffer.Get(), irBuffer.GetSize(), GetSampleRate(), GetBlockSize());
+    // Turning the reduced rate on or off changes the latency and the IR's rate,
+    // like an engine switch it waits for the transport to stop
+    if (!GetTransportIsRunning() && GetTargetDecimation() != mDecimation) {
+        UpdateDecimation();
+        ResetRealtime();
+        irBuffer.OnReset(GetConvolutionRate());
+        UpdateLatency();
+    }
+
+    // BuildIr() already handed the IR to the convolvers on the worker, their latency follows here
+    if (irBuffer.Commit()) {
+        if (!mIsOffline) {
+            UpdateLatency();
+        }
+
+#if defined(NEZCAB_BENCHMARKS)
+        const IrBuffer::LoadStats loadStats = irBuffer.GetLoadStats();
+        DBGMSG("IR load (ms): open %.1f, decode %.1f, %s %.1f, build %.1f; bytes: file %zu, source %zu, ir %zu%s%s\n",
+            1000. * loadStats.openSeconds, 1000. * loadStats.decodeSeconds, loadStats.prebuilt ? "prebuilt" : "resample", 1000. * loadStats.resampleSeconds,
+            1000. * loadStats.buildSeconds, loadStats.fileBytes, loadStats.sourceBytes, loadStats.irBytes,
+            loadStats.sharedSource ? ", shared source" : "", loadStats.sharedIr ? ", shared ir" : "");
+        IrBuffer::MemoryUsage usage = irBuffer.GetMemoryUsage();
+#if defined(USE_AUTO_CONVOLVER)
+        const size_t convolverBytes = convolutionDsp.GetMemoryUsage();
 #else
-        convolutionDsp[0].SetIr(irBuffer.Get(), irBuffer.GetSize());
-        convolutionDsp[1].SetIr(irBuffer.Get(), irBuffer.GetSize());
+        const size_t convolverBytes = convolutionDsp[0].GetMemoryUsage() + convolutionDsp[1].GetMemoryUsage();
+#endif
+        DBGMSG("IR memory (bytes): source %zu, staged %zu, ir %zu, convolvers ~%zu\n", usage.source, usage.staged, usage.ir, convolverBytes);
+        // Whenever some engine runs its tails on the pool
+        if (std::shared_ptr<ThreadPool> pool = ThreadPool::Find()) {
+            std::vector<ThreadPool::WorkerStats> workerStats = pool->GetStats();
+            for (size_t i = 0; i < workerStats.size(); i++) {
+                DBGMSG("Tail worker %zu: %.1f%% busy, %llu tasks, %llu stolen\n", i, 100. * workerStats[i].utilisation,
+                    (unsigned long long)workerStats[i].tasksRun, (unsigned long long)workerStats[i].tasksStolen);
+            }
+            pool->ResetStats();
+        }
 #endif
-        irBuffer.mIsStaged = false;
     }
-}
+#if defined(USE_AUTO_CONVOLVER)
+    // Once the IR's class is tuned the IR moves to the fastest engine. The switch
+    // cuts the running tail and may change the latency, so it waits for the
+    // transport to stop unless a new IR comes first.
+    else if (!GetTransportIsRunning() && convolutionDsp.NeedsUpdate()) {
+        irBuffer.Rebuild();
+    }
+#endif
 
-void NeZcab::OnReset() {
-    irBuffer.OnReset(GetSampleRate());
-    
-    if (irBuffer.mIsStaged) {
-#if defined(USE_WDL_CONVOLVER)
-        convolutionDsp[0].SetIr(irBuffer.Get(), irBuffer.GetSize(), GetSampleRate(), GetBlockSize());
-        convolutionDsp[1].SetIr(irBuffer.Get(), irBuffer.GetSize(), GetSampleRate(), GetBlockSize());
+    const IrBuffer::LoadError error = irBuffer.PollError();
+#if IPLUG_EDITOR
+    if (error != IrBuffer::kLoadOk && GetUI() != nullptr) {
+        GetUI()->ShowMessageBox(IrBuffer::GetLoadErrorName(error), "Load IR", kMB_OK);
+    }
 #else
-        convolutionDsp[0].SetIr(irBuffer.Get(), irBuffer.GetSize());
-        convolutionDsp[1].SetIr(irBuffer.Get(), irBuffer.GetSize());
+    (void)error;
 #endif
-        irBuffer.mIsStaged = false;
+
+    if (!mIsOffline && offlineDsp[0].IsReady()) {
+        offlineDsp[0].Clear();
+        offlineDsp[1].Clear();
     }
+}
+
+void NeZcab::OnReset() {
+    UpdateDecimation();
 
-#if defined(USE_WDL_CONVOLVER)
+    // Resampling for the new rate happens on the IrBuffer worker,
+    // the current IR keeps running until OnIdle commits the new one
+    irBuffer.OnReset(GetConvolutionRate());
+    ResetRealtime();
+
+    offlineDsp[0].OnReset();
+    offlineDsp[1].OnReset();
+    UpdateRenderMode();
+
+    mMeterSender.Reset(GetSampleRate());
+}
+
+// Clears the multirate stages and the realtime convolvers. Safe while audio
+// runs, so OnIdle may call it too: they reset under the lock their process()
+// only try-locks, HISSToolsConvolver just flags a reset for its next process().
+void NeZcab::ResetRealtime() {
+    multirate[0].OnReset(mDecimation);
+    multirate[1].OnReset(mDecimation);
+
+#if defined(USE_AUTO_CONVOLVER)
+    convolutionDsp.OnReset(GetConvolutionRate());
+#elif defined(USE_WDL_CONVOLVER)
     convolutionDsp[0].OnReset();
     convolutionDsp[1].OnReset();
-    SetLatency(convolutionDsp->GetLatency());
+#elif defined(TWOSTAGE_CONVOLVER)
+    convolutionDsp[0].OnReset(GetConvolutionRate());
+    convolutionDsp[1].OnReset(GetConvolutionRate());
 #else
     convolutionDsp[0].OnReset();
     convolutionDsp[1].OnReset();
 #endif
+}
 
-    mMeterSender.Reset(GetSampleRate());
+// Hosts reset before an offline render and again before playback resumes.
+// Blocking is fine when entering offline mode, nothing renders in realtime then.
+void NeZcab::UpdateRenderMode() {
+    const bool offline = GetRenderingOffline();
+    if (offline) {
+        std::shared_ptr<const IrBuffer::IrSamples> ir = irBuffer.GetCommitted();
+        if (ir != nullptr) {
+            offlineDsp[0].SetIr(ir->data(), ir->size(), GetConvolutionRate());
+            offlineDsp[1].SetIr(ir->data(), ir->size(), GetConvolutionRate());
+        }
+    }
+    // Without an IR there is nothing to speed up, stay on the realtime convolvers
+    mIsOffline = offline && offlineDsp[0].IsReady();
+    UpdateLatency();
+}
+
+// The multirate stage delays its high band by the running convolver's
+// latency too, the host gets the sum
+void NeZcab::UpdateLatency() {
+    const int convolverLatency = mIsOffline ? offlineDsp[0].GetLatency() : GetRealtimeLatency();
+    multirate[0].SetConvolverLatency(convolverLatency);
+    multirate[1].SetConvolverLatency(convolverLatency);
+    SetLatency(GetHostLatency(convolverLatency));
+}
+
+// In convolution rate samples
+int NeZcab::GetRealtimeLatency() {
+#if defined(USE_AUTO_CONVOLVER)
+    return convolutionDsp.GetLatency();
+#elif defined(USE_WDL_CONVOLVER)
+    return convolutionDsp->GetLatency();
+#else
+    return 0;
+#endif
+}
+
+// Convolver latency is counted in convolution rate samples
+int NeZcab::GetHostLatency(int convolverLatency) {
+    if (mDecimation == 1) { return convolverLatency; }
+    return multirate[0].GetLatency() + convolverLatency * mDecimation;
+}
+
+// Reduced rate processing is opt-in, it adds latency and flattens the IR above the reduced Nyquist
+int NeZcab::GetTargetDecimation() {
+    return GetParam(kParamMultirate)->Bool() ? MultirateStage::GetDecimation(GetSampleRate()) : 1;
+}
+
+void NeZcab::UpdateDecimation() {
+    mDecimation = GetTargetDecimation();
+    mConvolutionBlockSize = std::max(GetBlockSize() / mDecimation, 1);
+}
+
+// IRs are resampled to this rate and the convolvers run at it
+double NeZcab::GetConvolutionRate() {
+    return GetSampleRate() / mDecimation;
+}
+
+// Convolvers inside the multirate stage see the host blocks decimated
+int NeZcab::GetConvolutionBlockSize() {
+    return mConvolutionBlockSize;
+}
+
+// Runs on the IR worker with every new IR, see IrBuffer::SetBuilder(). Engines
+// build in their spares and swap in under their locks, so audio keeps running.
+void NeZcab::BuildIr(const IrBuffer::IrSamples& ir, double sampleRate) {
+#if defined(USE_AUTO_CONVOLVER)
+    convolutionDsp.SetIr(ir.data(), ir.size(), sampleRate, GetConvolutionBlockSize());
+#elif defined(USE_WDL_CONVOLVER)
+    convolutionDsp[0].SetIr(ir.data(), ir.size(), sampleRate, GetConvolutionBlockSize());
+    convolutionDsp[1].SetIr(ir.data(), ir.size(), sampleRate, GetConvolutionBlockSize());
+#else
+    convolutionDsp[0].SetIr(ir.data(), ir.size());
+    convolutionDsp[1].SetIr(ir.data(), ir.size());
+#endif
+    if (mIsOffline) {
+        offlineDsp[0].SetIr(ir.data(), ir.size(), sampleRate);
+        offlineDsp[1].SetIr(ir.data(), ir.size(), sampleRate);
+    }
+    if (mDecimation > 1) {
+        const float highBandGain = MultirateStage::EstimateHighBandGain(ir.data(), ir.size());
+        multirate[0].SetHighBandGain(highBandGain);
+        multirate[1].SetHighBandGain(highBandGain);
+    }
 }
 
 void NeZcab::OnParamChange(int paramIdx) {
@@ -118,4 +362,41 @@ void NeZcab::OnParamChangeUI(int paramIdx, EParamSource source) {
 bool NeZcab::OnMessage(int msgTag, int ctrlTag, int dataSize, const void* pData) {
     return false;
 }
+
+void NeZcab::OnActivate(bool active) {
+    mIsActive = active;
+    UpdateIrPriority();
+}
+
+void NeZcab::OnUIOpen() {
+    Plugin::OnUIOpen();
+    mIsVisible = true;
+    UpdateIrPriority();
+}
+
+void NeZcab::OnUIClose() {
+    Plugin::OnUIClose();
+    mIsVisible = false;
+    UpdateIrPriority();
+}
+
+// While a session loads, IRs of open editors are built first, then those of active instances
+void NeZcab::UpdateIrPriority() {
+    irBuffer.SetPriority(mIsVisible ? IrBuffer::kPriorityVisible : mIsActive ? IrBuffer::kPriorityActive : IrBuffer::kPriorityBackground);
+}
+
+// Params come first, so sessions saved before the IR was stored still load.
+// The IR state never fails, a missing file must not lose the params.
+bool NeZcab::SerializeState(IByteChunk& chunk) const {
+    if (!SerializeParams(chunk)) { return false; }
+    irBuffer.SerializeState(chunk);
+    return true;
+}
+
+int NeZcab::UnserializeState(const IByteChunk& chunk, int startPos) {
+    int pos = UnserializeParams(chunk, startPos);
+    if (pos < 0) { return pos; }
+    int irPos = irBuffer.UnserializeState(chunk, pos);
+    return irPos < 0 ? pos : irPos;
+}
 #endif
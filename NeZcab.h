@@ -5,15 +5,30 @@
 
 #include "IrBuffer.h"
 
-#define USE_HISSTOOLS_CONVOLVER
+// USE_AUTO_CONVOLVER picks HISSTools, TwoStage, WDL or the multichannel layout per IR class with a per-machine profile
+#define USE_AUTO_CONVOLVER
+// Adds developer tools (resampler and convolver benchmarks, IR converter) to the UI
+//#define NEZCAB_BENCHMARKS
 
-#if defined(USE_HISSTOOLS_CONVOLVER)
+#if defined(USE_AUTO_CONVOLVER)
+    #include "AutoConvolver.h"
+#elif defined(USE_HISSTOOLS_CONVOLVER)
     #include "HISSToolsConvolver.h"
 #elif defined(TWOSTAGE_CONVOLVER)
     #include "TwoStageConvolver.h"
 #elif defined(USE_WDL_CONVOLVER)
     #include "WDL_convolver.h"
 #endif
+#include "OfflineConvolver.h"
+#include "MultirateStage.h"
+#include "DenormalGuard.h"
+
+#if defined(NEZCAB_BENCHMARKS)
+    #include "ResamplerBenchmark.h"
+    #include "ConvolverBenchmark.h"
+    #include "IrConverter.h"
+    #include "ThreadPool.h"
+#endif
 
 
 const int kNumPresets = 1;
@@ -21,6 +36,7 @@ const int kNumPresets = 1;
 enum EParams {
     kParamGain = 0,
     kParamResample,
+    kParamMultirate,
     kNumParams
 };
 
@@ -44,21 +60,73 @@ public:
     void OnParamChangeUI(int paramIdx, EParamSource source) override;
     void OnIdle() override;
     bool OnMessage(int msgTag, int ctrlTag, int dataSize, const void* pData) override;
+    bool SerializeState(IByteChunk& chunk) const override;
+    int UnserializeState(const IByteChunk& chunk, int startPos) override;
+    void OnActivate(bool active) override;
+    void OnUIOpen() override;
+    void OnUIClose() override;
 
 private:
+    void UpdateIrPriority();
+    void UpdateRenderMode();
+    void ResetRealtime();
+    void UpdateLatency();
+    int GetRealtimeLatency();
+    int GetHostLatency(int convolverLatency);
+    int GetTargetDecimation();
+    void UpdateDecimation();
+    double GetConvolutionRate();
+    int GetConvolutionBlockSize();
+    void BuildIr(const IrBuffer::IrSamples& ir, double sampleRate);
+
+    // A mono engine per channel
+    template <typename Convolver>
+    void Convolve(Convolver (&dsp)[2], sample** inputs, sample** outputs, int nFrames) {
+        for (int c = 0; c < 2; c++) {
+            if (mDecimation > 1) {
+                multirate[c].process(dsp[c], inputs + c, outputs + c, nFrames);
+            }
+            else {
+                dsp[c].process(inputs + c, outputs + c, nFrames);
+            }
+        }
+    }
+
+    // One engine for both channels
+    template <typename Convolver>
+    void Convolve(Convolver& dsp, sample** inputs, sample** outputs, int nFrames) {
+        if (mDecimation > 1) {
+            MultirateStage::ProcessPair(multirate, dsp, inputs, outputs, nFrames);
+        }
+        else {
+            dsp.process(inputs, outputs, nFrames);
+        }
+    }
+
     IPeakAvgSender<2> mMeterSender;
+    std::atomic<bool> mIsActive{ false };
+    std::atomic<bool> mIsVisible{ false };
 #endif
 
 private:
-    
-    IrBuffer irBuffer;
-
-    #if defined(USE_HISSTOOLS_CONVOLVER)
+    #if defined(USE_AUTO_CONVOLVER)
+        AutoConvolver convolutionDsp;
+    #elif defined(USE_HISSTOOLS_CONVOLVER)
         HISSToolsConvolver convolutionDsp[2] = { HISSToolsConvolver() , HISSToolsConvolver() };
     #elif defined(TWOSTAGE_CONVOLVER)
         TwoStageConvolver convolutionDsp[2] = { TwoStageConvolver() , TwoStageConvolver() };
     #elif defined(USE_WDL_CONVOLVER)
-        WdlConvolver convolutionDsp[2] = { WdlConvolver() , WdlConvolver() };
+        WdlConvolver convolutionDsp[2] = { WdlConvolver(true) , WdlConvolver(true) };
     #endif
-    
+    // Used instead of convolutionDsp while the host renders offline
+    OfflineConvolver offlineDsp[2];
+    std::atomic<bool> mIsOffline{ false };
+    // With kParamMultirate on, at 88.2 kHz and up the convolvers run at a half or quarter rate
+    MultirateStage multirate[2];
+    std::atomic<int> mDecimation{ 1 };
+    // Host block size over mDecimation, read by the IR worker
+    std::atomic<int> mConvolutionBlockSize{ 1 };
+
+    // Declared last, so its worker has stopped before the convolvers it builds are destroyed
+    IrBuffer irBuffer;
 };
@@ -0,0 +1,192 @@
+#pragma once
+
+#include "HISSToolsConvolver.h"
+#include "TwoStageConvolver.h"
+#include "WDL_convolver.h"
+#include "DirectConvolver.h"
+#include "NonUniformConvolver.h"
+#include "ConvolverTuner.h"
+#include "IPlugConstants.h"
+#include "Trace.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Convolves a stereo pair with the engine ConvolverTuner found fastest for
+// the IR's class on this machine: a mono engine per channel, for short IRs
+// possibly the time-domain DirectConvolver, or one NonUniformConvolver for
+// both channels. Until the class is tuned HISSToolsConvolver runs,
+// NeedsUpdate() then asks for the IR again. The engine switched away from
+// is cleared, only the running one holds IR spectra.
+class AutoConvolver {
+public:
+    static constexpr int kNumChannels = 2;
+
+    AutoConvolver() :
+        mTuner(ConvolverTuner::Get()),
+        mMultichannel(kNumChannels, NonUniformConvolver::MakeBlockSizes(64, 4096), true, true)
+    {}
+    ~AutoConvolver() {}
+
+    void OnReset(double sampleRate) {
+        for (int c = 0; c < kNumChannels; c++) {
+            mHISSTools[c].OnReset();
+            mTwoStage[c].OnReset(sampleRate);
+            mWdl[c].OnReset();
+            mDirect[c].OnReset();
+        }
+        mMultichannel.OnReset();
+    }
+
+    int SetIr(const float* ir, size_t length, double sampleRate, int blockSize) {
+        return Init(ir, length, sampleRate, blockSize);
+    }
+
+    int SetIr(const double* ir, size_t length, double sampleRate, int blockSize) {
+        return Init(ir, length, sampleRate, blockSize);
+    }
+
+    // True once the current IR's class got tuned, SetIr() again to switch engines.
+    // May be called while SetIr() runs on another thread.
+    bool NeedsUpdate() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mTuned || mLength == 0) { return false; }
+        const uint64_t version = mTuner->GetVersion();
+        if (version == mVersion) { return false; }
+        mVersion = version;
+        return mTuner->IsTuned(mLength, mBlockSize, mSampleRate);
+    }
+
+    ConvolverTuner::Backend GetBackend() const {
+        return mBackend.load();
+    }
+
+    int GetLatency() {
+        switch (mBackend.load()) {
+        case ConvolverTuner::kBackendWdl: return mWdl[0].GetLatency();
+        case ConvolverTuner::kBackendMultichannel: return mMultichannel.GetLatency();
+        default: return 0;
+        }
+    }
+
+    size_t GetMemoryUsage() const {
+        size_t bytes = mMultichannel.GetMemoryUsage();
+        for (int c = 0; c < kNumChannels; c++) {
+            bytes += mHISSTools[c].GetMemoryUsage() + mTwoStage[c].GetMemoryUsage() + mWdl[c].GetMemoryUsage() + mDirect[c].GetMemoryUsage();
+        }
+        return bytes;
+    }
+
+    // inputs and outputs hold kNumChannels channels
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        switch (mBackend.load(std::memory_order_acquire)) {
+        case ConvolverTuner::kBackendTwoStage:
+            Process(mTwoStage, inputs, outputs, nFrames);
+            break;
+        case ConvolverTuner::kBackendWdl:
+            Process(mWdl, inputs, outputs, nFrames);
+            break;
+        case ConvolverTuner::kBackendDirect:
+            Process(mDirect, inputs, outputs, nFrames);
+            break;
+        case ConvolverTuner::kBackendMultichannel:
+            mMultichannel.process(inputs, outputs, nFrames);
+            break;
+        default:
+            Process(mHISSTools, inputs, outputs, nFrames);
+            break;
+        }
+    }
+
+private:
+    template <typename Convolver>
+    static void Process(Convolver (&convolvers)[kNumChannels], iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        for (int c = 0; c < kNumChannels; c++) {
+            convolvers[c].process(inputs + c, outputs + c, nFrames);
+        }
+    }
+
+    // The chosen engine gets the IR before process() switches to it
+    template <typename T>
+    int Init(const T* ir, size_t length, double sampleRate, int blockSize) {
+        TRACE_SCOPE("AutoConvolver::SetIr");
+        ConvolverTuner::Config config;
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mVersion = mTuner->GetVersion();
+            mTuned = mTuner->Lookup(length, blockSize, sampleRate, config);
+            mLength = length;
+            mBlockSize = blockSize;
+            mSampleRate = sampleRate;
+        }
+
+        int err = 0;
+        if (config.backend == ConvolverTuner::kBackendMultichannel) {
+            mMultichannel.SetBlockSizes(ConvolverTuner::GetMultichannelBlockSizes(config));
+            err = mMultichannel.SetIr(ir, length);
+        }
+        for (int c = 0; c < kNumChannels && err == 0; c++) {
+            switch (config.backend) {
+            case ConvolverTuner::kBackendMultichannel:
+                break;
+            case ConvolverTuner::kBackendTwoStage:
+                mTwoStage[c].SetBlockSizes(config.headBlockSize, config.tailBlockSize);
+                err = mTwoStage[c].SetIr(ir, length) == 0 ? 0 : 1;
+                break;
+            case ConvolverTuner::kBackendWdl:
+                err = mWdl[c].SetIr(ir, length, sampleRate, blockSize);
+                break;
+            case ConvolverTuner::kBackendDirect:
+                err = mDirect[c].SetIr(ir, length);
+                break;
+            default:
+                err = mHISSTools[c].SetIr(ir, length) == CONVOLVE_ERR_NONE ? 0 : 1;
+                break;
+            }
+        }
+        if (err == 0) {
+            const ConvolverTuner::Backend previous = mBackend.exchange(config.backend, std::memory_order_acq_rel);
+            if (previous != config.backend) {
+                Clear(previous);
+            }
+        }
+        return err;
+    }
+
+    // Each engine clears under a lock its process() only try-locks (HISSTools
+    // under its own), so a block still on the old engine doesn't wait
+    void Clear(ConvolverTuner::Backend backend) {
+        if (backend == ConvolverTuner::kBackendMultichannel) {
+            mMultichannel.Clear();
+            return;
+        }
+        for (int c = 0; c < kNumChannels; c++) {
+            switch (backend) {
+            case ConvolverTuner::kBackendTwoStage: mTwoStage[c].Clear(); break;
+            case ConvolverTuner::kBackendWdl: mWdl[c].Clear(); break;
+            case ConvolverTuner::kBackendDirect: mDirect[c].Clear(); break;
+            default: mHISSTools[c].Clear(); break;
+            }
+        }
+    }
+
+    std::shared_ptr<ConvolverTuner> mTuner;
+    HISSToolsConvolver mHISSTools[kNumChannels];
+    TwoStageConvolver mTwoStage[kNumChannels];
+    WdlConvolver mWdl[kNumChannels];
+    DirectConvolver mDirect[kNumChannels];
+    NonUniformConvolver mMultichannel;
+    std::atomic<ConvolverTuner::Backend> mBackend{ ConvolverTuner::kBackendHISSTools };
+
+    // The IR class SetIr() last looked up, guarded by mMutex
+    std::mutex mMutex;
+    size_t mLength = 0;
+    int mBlockSize = 0;
+    double mSampleRate = 44100.;
+    uint64_t mVersion = 0;
+    bool mTuned = false;
+};
+
+END_IPLUG_NAMESPACE
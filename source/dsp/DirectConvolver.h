@@ -0,0 +1,165 @@
+#pragma once
+
+#include "IPlugConstants.h"
+#include "AlignedArena.h"
+#include "AH_VectorOps.h"
+#include "Trace.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Time-domain FIR for short IRs: no FFTs, no partitions, zero latency.
+// The input history is a circular buffer written twice, N samples apart,
+// so the newest N samples are always contiguous and each output is one
+// SIMD dot product with the reversed taps. Taps are padded to whole
+// vectors. Same swap and spare scheme as MultichannelConvolver.
+class DirectConvolver {
+public:
+    // Beyond this the cost per sample grows past any FFT engine
+    static constexpr size_t kMaxLength = 2048;
+
+    DirectConvolver() {}
+    ~DirectConvolver() {}
+
+    void OnReset() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mState != nullptr) {
+            mState->Reset();
+        }
+    }
+
+    // Fails for IRs longer than kMaxLength
+    int SetIr(const float* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    int SetIr(const double* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    // Frees the taps and history, process() passes the input through until the next SetIr()
+    void Clear() {
+        std::unique_ptr<State> state;
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mState.swap(state);
+        }
+        mSpare.reset();
+    }
+
+    size_t GetMemoryUsage() const {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        return (mState != nullptr ? mState->arena.GetCapacity() : 0) + (mSpare != nullptr ? mSpare->arena.GetCapacity() : 0);
+    }
+
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("DirectConvolver::process");
+        iplug::sample* inPtr = inputs[0];
+        iplug::sample* outPtr = outputs[0];
+
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (!lock.owns_lock() || mState == nullptr) {
+            if (outPtr != inPtr) {
+                std::copy(inPtr, inPtr + nFrames, outPtr);
+            }
+            return;
+        }
+
+        State& state = *mState;
+        const size_t numTaps = state.numTaps;
+        for (int s = 0; s < nFrames; s++) {
+            const float x = (float)inPtr[s];
+            state.history[state.position] = x;
+            state.history[state.position + numTaps] = x;
+            state.position = state.position + 1 == numTaps ? 0 : state.position + 1;
+            // Oldest first, the newest sample is the last one
+            outPtr[s] = (iplug::sample)DotProduct(state.taps, state.history + state.position, numTaps);
+        }
+    }
+
+private:
+    struct State {
+        size_t numTaps = 0;      // IR length padded to whole vectors
+        size_t position = 0;     // history slot the next sample goes to
+        AlignedArena arena;
+        float* taps = nullptr;       // reversed IR, zero padded at the front
+        float* history = nullptr;    // 2 x numTaps
+
+        bool Layout(size_t length) {
+            numTaps = (length + 3) & ~(size_t)3;
+            position = 0;
+            arena.Begin();
+            const size_t tapsIndex = arena.Reserve<float>(numTaps);
+            const size_t historyIndex = arena.Reserve<float>(2 * numTaps);
+            if (!arena.Commit()) { return false; }
+            taps = arena.Get<float>(tapsIndex);
+            history = arena.Get<float>(historyIndex);
+            return true;
+        }
+
+        void Reset() {
+            std::fill(history, history + 2 * numTaps, 0.f);
+            position = 0;
+        }
+    };
+
+    template <typename T>
+    int Init(const T* ir, size_t length) {
+        TRACE_SCOPE("DirectConvolver::SetIr");
+        if (length == 0 || length > kMaxLength) { return 1; }
+
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        if (mSpare == nullptr) {
+            mSpare = std::make_unique<State>();
+        }
+        State& state = *mSpare;
+        if (!state.Layout(length)) { return 1; }
+
+        // Commit() zeroed the arena, the padding taps stay zero
+        const size_t padding = state.numTaps - length;
+        for (size_t i = 0; i < length; i++) {
+            state.taps[padding + i] = static_cast<float>(ir[length - 1 - i]);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mState.swap(mSpare);
+        }
+        return 0;
+    }
+
+    static float DotProduct(const float* a, const float* b, size_t count) {
+#if defined(TARGET_INTEL)
+        // Two accumulators hide the add latency, count is a multiple of 4
+        vFloat sum0 = float2vector(0.f);
+        vFloat sum1 = float2vector(0.f);
+        size_t i = 0;
+        for (; i + 8 <= count; i += 8) {
+            sum0 = F32_VEC_ADD_OP(sum0, F32_VEC_MUL_OP(F32_VEC_ULOAD(a + i), F32_VEC_ULOAD(b + i)));
+            sum1 = F32_VEC_ADD_OP(sum1, F32_VEC_MUL_OP(F32_VEC_ULOAD(a + i + 4), F32_VEC_ULOAD(b + i + 4)));
+        }
+        if (i < count) {
+            sum0 = F32_VEC_ADD_OP(sum0, F32_VEC_MUL_OP(F32_VEC_ULOAD(a + i), F32_VEC_ULOAD(b + i)));
+        }
+        float lanes[4];
+        F32_VEC_USTORE(lanes, F32_VEC_ADD_OP(sum0, sum1));
+        return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#else
+        float sum = 0.f;
+        for (size_t i = 0; i < count; i++) {
+            sum += a[i] * b[i];
+        }
+        return sum;
+#endif
+    }
+
+    std::mutex mMutex;
+    mutable std::mutex mBuildMutex;
+    std::unique_ptr<State> mState;
+    std::unique_ptr<State> mSpare;
+};
+
+END_IPLUG_NAMESPACE
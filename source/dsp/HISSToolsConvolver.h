@@ -3,6 +3,7 @@
 
 #include "Convolver.h"
 #include "IPlugConstants.h"
+#include "Trace.h"
 
 BEGIN_IPLUG_NAMESPACE
 
@@ -17,19 +18,32 @@ public:
         mConvolver.reset();
     }
 
-    ConvolveError SetIr(float* ir, size_t length) {
-        ConvolveError err = mConvolver.set(0, 0, ir, length, true);
-        mCanProcess = (err == CONVOLVE_ERR_NONE);
-        return err;
+    ConvolveError SetIr(const float* ir, size_t length) {
+        TRACE_SCOPE("HISSToolsConvolver::SetIr");
+        return Init(ir, length);
     }
 
-    ConvolveError SetIr(double* ir, size_t length) {
-        ConvolveError err = mConvolver.set(0, 0, ir, length, true);
-        mCanProcess = (err == CONVOLVE_ERR_NONE);
-        return err;
+    ConvolveError SetIr(const double* ir, size_t length) {
+        TRACE_SCOPE("HISSToolsConvolver::SetIr");
+        return Init(ir, length);
+    }
+
+    // Frees the partitions, process() passes the input through until the next SetIr().
+    // HISSTools locks the IR against its own process(), so this is safe while audio runs.
+    void Clear() {
+        mCanProcess = false;
+        mConvolver.clear(true);
+        mLength = 0;
+        mCapacity = 0;
+    }
+
+    // Estimate: partition spectra plus input history, each about twice the longest IR so far
+    size_t GetMemoryUsage() const {
+        return 4 * mCapacity * sizeof(float);
     }
 
     void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("HISSToolsConvolver::process");
         if (mCanProcess) {
             mConvolver.process(inputs, outputs, 1, 1, (size_t)nFrames);
             return;
@@ -40,8 +54,23 @@ public:
     }
 
 private:
+    // Partitions are only reallocated for an IR longer than any before, a shorter one reuses them
+    template <typename T>
+    ConvolveError Init(const T* ir, size_t length) {
+        const bool resize = length > mCapacity;
+        ConvolveError err = mConvolver.set(0, 0, ir, length, resize);
+        mCanProcess = (err == CONVOLVE_ERR_NONE);
+        mLength = mCanProcess ? length : 0;
+        if (mCanProcess && resize) {
+            mCapacity = length;
+        }
+        return err;
+    }
+
     HISSTools::Convolver mConvolver;
 
+    size_t mLength = 0;
+    size_t mCapacity = 0;
     bool mCanProcess = false;
 };
 
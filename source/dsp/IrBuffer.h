@@ -1,10 +1,23 @@
 #pragma once
 
 #include "IAudioFile.h"
+#include "IPlugStructs.h"
 #include "Resampler.h"
+#include "AlignedBuffer.h"
+#include "IrRegistry.h"
+#include "IrFile.h"
+#include "PriorityJobQueue.h"
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
 #include <memory>
 #include <vector>
 #include <cmath>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 #include "string.h"
 
 #include "resample.h"
@@ -15,66 +28,305 @@ using namespace r8b;
 
 
 
+// Single owner of the IR samples. The decoded source is dropped once the
+// resampled IR is built (and decoded again from mFilePath when a new rate
+// or resampler needs it), the resampled IR lives in one aligned buffer that
+// the convolvers borrow while building their spectra. Sources and IRs come
+// from the process-wide IrRegistry, so instances loading the same file share them.
+// The committed IR, and the source while it is in memory, are also stored in
+// the plugin state, so a session recalled at the same rate needs neither the
+// file nor a resample.
+// IRs are built on the process-wide PriorityJobQueue, so a session with many
+// instances builds as many IRs at once as there are cores, most important first.
+// Hashing and decoding the file run there too, and so does the owner's
+// builder that hands each IR to its convolvers, so neither a load nor a
+// recall blocks the UI or restore thread.
+// NeZcab IR files (.nzir, see IrFile) load like WAVs, and a prebuilt
+// <name>.<rate>.nzir next to the loaded file replaces the resample.
 class IrBuffer {
 public:
-    enum ResamplerType { WDL_RESAMPLER, CUSTOM_RESAMPLE, LINEAR_RESAMPLE, R8BRAIN_RESAMPLE, RESAMPLE_COUNT };
+    // CUSTOM_HQ_RESAMPLE is the custom resampler with cubic interpolation between
+    // its filter phases, which only arbitrary rate ratios use
+    enum ResamplerType { WDL_RESAMPLER, CUSTOM_RESAMPLE, LINEAR_RESAMPLE, R8BRAIN_RESAMPLE, CUSTOM_HQ_RESAMPLE, RESAMPLE_COUNT };
+
+    typedef AlignedBuffer<float> SourceSamples;
+    typedef AlignedBuffer<WDL_FFT_REAL> IrSamples;
+    typedef IrRegistry<SourceSamples, IrSamples> Registry;
+
+    struct MemoryUsage {
+        size_t source = 0;
+        size_t staged = 0;
+        size_t ir = 0;
+    };
+
+    enum LoadError { kLoadOk = 0, kLoadErrorNoFile, kLoadErrorOpen, kLoadErrorFormat, kLoadErrorEmpty, kLoadErrorMemory, kLoadErrorResample };
+
+    // Where the latest load's time went, in seconds. Stages that didn't run
+    // stay 0: no decode when another instance holds the source already, no
+    // resample when the IR was shared or prebuilt. Rate or resampler changes
+    // only redo the resample and build stages.
+    struct LoadStats {
+        LoadError error = kLoadOk;
+        double openSeconds = 0.;      // hashing the file and parsing its header
+        double decodeSeconds = 0.;    // reading channel 0, IAudioFile extracts it while decoding
+        double resampleSeconds = 0.;  // or reading the prebuilt .nzir
+        double buildSeconds = 0.;     // the builder, see SetBuilder()
+        size_t fileBytes = 0;
+        size_t sourceBytes = 0;
+        size_t irBytes = 0;
+        bool sharedSource = false;
+        bool sharedIr = false;
+        bool prebuilt = false;
+
+        double GetTotalSeconds() const {
+            return openSeconds + decodeSeconds + resampleSeconds + buildSeconds;
+        }
+    };
+
+    static const char* GetLoadErrorName(LoadError error) {
+        switch (error) {
+        case kLoadOk: return "ok";
+        case kLoadErrorNoFile: return "no file";
+        case kLoadErrorOpen: return "can't open the file";
+        case kLoadErrorFormat: return "not a supported audio file";
+        case kLoadErrorEmpty: return "the file has no samples";
+        case kLoadErrorMemory: return "out of memory";
+        case kLoadErrorResample: return "resampling failed";
+        default: return "?";
+        }
+    }
+
+    // Higher priorities are built first
+    enum Priority { kPriorityBackground = 0, kPriorityActive, kPriorityVisible };
 
     IrBuffer(double sampleRate, enum ResamplerType resamplerType = R8BRAIN_RESAMPLE) :
         mSampleRate(sampleRate),
-        mResamplerType(resamplerType)
+        mResamplerType(resamplerType),
+        mQueue(PriorityJobQueue::Get())
     {
+        mQueue->Add(this, [this]() { RunJob(); });
+    }
+
+    ~IrBuffer() {
+        mQueue->Remove(this);
+    }
+
+    // Instances the user is looking at or playing through get their IR first
+    void SetPriority(Priority priority) {
+        mQueue->SetPriority(this, priority);
     }
 
     void SetResampler(ResamplerType resamplerType = R8BRAIN_RESAMPLE) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (resamplerType == mResamplerType) { return; }
         mResamplerType = resamplerType;
 
-        if (baseIR == nullptr) { return; }
-
-        if (Resample() != 0) {
-            return;
-        }
-        mIsStaged = true;
+        if (!HasSource()) { return; }
+        PostJob();
     }
 
+    // Safe to call from the host reset callback (possibly the audio thread).
+    // Only the new rate is recorded here - the worker resamples, while the
+    // convolvers keep running the previously committed IR until Commit().
     void OnReset(double sampleRate) {
+        std::lock_guard<std::mutex> lock(mMutex);
         if (sampleRate == mSampleRate) { return; }
         mSampleRate = sampleRate;
 
-        if (baseIR == nullptr) { return; }
+        if (!HasSource()) { return; }
+        PostJob();
+    }
 
-        if (Resample() != 0) {
-            return;
-        }
-        mIsStaged = true;
+    // Only records the file, the worker hashes, decodes and resamples it.
+    // The current IR keeps playing until the new one is built, a file that
+    // fails to load leaves it in place and reports through PollError().
+    LoadError LoadIr(WDL_String& filePath, WDL_String& directory) {
+        TRACE_SCOPE("IrBuffer::LoadIr");
+        if (filePath.GetLength() == 0) { return kLoadErrorNoFile; }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mLoadPath = filePath;
+        mLoadDirectory = directory;
+        PostJob();
+        return kLoadOk;
     }
 
-    int LoadIr(WDL_String& filePath, WDL_String& directory) {
-        HISSTools::IAudioFile file(filePath.Get());
-        if (file.getIsError()) {
-            // TODO: return error
-            return 1;
+    // The error of the latest load or resample that failed since the last call, kLoadOk if none
+    LoadError PollError() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const LoadError error = mError;
+        mError = kLoadOk;
+        return error;
+    }
+
+    LoadStats GetLoadStats() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mLoadStats;
+    }
+
+    // Runs on the worker with every new IR before it is staged, so the owner's
+    // convolvers build their spectra there. Commit() then only reports the IR.
+    // Set it before the first IR is loaded.
+    void SetBuilder(std::function<void(const IrSamples& ir, double sampleRate)> builder) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mBuilder = std::move(builder);
+    }
+
+    // Runs the builder on the committed IR again, e.g. once a faster engine is
+    // known. Commit() reports the IR once more when it is done.
+    void Rebuild() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mIR == nullptr) { return; }
+        mRebuild = true;
+        mQueue->Post(this);
+    }
+
+    // Appends the file path with the hash and stamp it had when loaded, the
+    // source if it is still in memory (here or in another instance) and the
+    // committed IR with the rate and resampler it was built for. Never reads
+    // the file, so saving can't fail on its account: once the source is
+    // dropped only the path and the IR are stored.
+    void SerializeState(iplug::IByteChunk& chunk) const {
+        std::unique_lock<std::mutex> lock(mMutex);
+        std::shared_ptr<const SourceSamples> source = baseIR;
+        std::shared_ptr<const IrSamples> ir = mIR;
+        WDL_String filePath(mFilePath.Get());
+        double srcRate = mBaseSampleRate;
+        const uint64_t hash = mSourceHash;
+        const Registry::FileStamp stamp = mSourceStamp;
+        const double irRate = mIrRate;
+        const int resamplerType = mIrResamplerType;
+        lock.unlock();
+
+        if (source == nullptr && hash != 0) {
+            source = Registry::Get().FindSource(hash, srcRate);
         }
 
-        // TODO: check if valid audio file
-        baseIR = std::make_unique<std::vector<float>>(file.getFrames());
-        file.readChannel(baseIR->data(), file.getFrames(), 0);
-        mBaseSampleRate = file.getSamplingRate();
+        const int version = kStateVersion;
+        chunk.Put(&version);
+        const int hasSource = source != nullptr;
+        chunk.Put(&hasSource);
+        chunk.PutStr(filePath.Get());
+        chunk.Put(&hash);
+        chunk.Put(&stamp.size);
+        chunk.Put(&stamp.modified);
+        chunk.Put(&srcRate);
+        if (hasSource) {
+            PutSamples(chunk, *source);
+        }
 
-        if (Resample() != 0) {
-            baseIR = nullptr;
-            mBaseSampleRate = 0.;
-            return 1;
+        const int hasIr = ir != nullptr;
+        chunk.Put(&hasIr);
+        if (hasIr) {
+            chunk.Put(&irRate);
+            chunk.Put(&resamplerType);
+            PutSamples(chunk, *ir);
         }
-        int sampleSize = sizeof(mIR->data()[0]);
+    }
 
-        mIsStaged = true;
+    // Returns the position after the IR state, or -1 if the chunk holds none
+    // (e.g. a session saved before IRs were stored). A stored IR built for
+    // the current rate and resampler only goes through the builder, otherwise
+    // the stored source is resampled on the worker, or the file decoded again
+    // if the state holds no source. Stored samples are only shared with other
+    // instances while the file on disk still has the stored size and
+    // modification time. The file is never read here, a changed one is
+    // hashed again on the worker when it is decoded.
+    int UnserializeState(const iplug::IByteChunk& chunk, int startPos) {
+        TRACE_SCOPE("IrBuffer::UnserializeState");
+        int version = 0;
+        int pos = chunk.Get(&version, startPos);
+        if (pos < 0 || version != kStateVersion) { return -1; }
+        int hasSource = 0;
+        pos = chunk.Get(&hasSource, pos);
+        if (pos < 0) { return -1; }
+
+        WDL_String filePath;
+        uint64_t hash = 0;
+        Registry::FileStamp stamp;
+        double srcRate = 0.;
+        std::shared_ptr<SourceSamples> source;
+        pos = chunk.GetStr(filePath, pos);
+        if (pos >= 0) { pos = chunk.Get(&hash, pos); }
+        if (pos >= 0) { pos = chunk.Get(&stamp.size, pos); }
+        if (pos >= 0) { pos = chunk.Get(&stamp.modified, pos); }
+        if (pos >= 0) { pos = chunk.Get(&srcRate, pos); }
+        if (pos >= 0 && hasSource) {
+            source = std::make_shared<SourceSamples>();
+            pos = GetSamples(chunk, *source, pos);
+        }
+
+        int hasIr = 0;
+        double irRate = 0.;
+        int resamplerType = 0;
+        std::shared_ptr<IrSamples> ir;
+        if (pos >= 0) { pos = chunk.Get(&hasIr, pos); }
+        if (pos >= 0 && hasIr) {
+            ir = std::make_shared<IrSamples>();
+            pos = chunk.Get(&irRate, pos);
+            if (pos >= 0) { pos = chunk.Get(&resamplerType, pos); }
+            if (pos >= 0) { pos = GetSamples(chunk, *ir, pos); }
+        }
+        if (pos < 0 || (source != nullptr && source->empty()) || resamplerType < 0 || resamplerType >= RESAMPLE_COUNT) { return -1; }
+        if (source == nullptr && filePath.GetLength() == 0) { return pos; }
+
+        // The stored hash only names the stored samples while the file is
+        // unchanged, anything else would hand other instances a wrong IR
+        const bool shared = hash != 0 && stamp.IsValid() && filePath.GetLength() > 0 && Registry::StampFile(filePath.Get()) == stamp;
+
+        // Instances recalling the same IR share one copy, as if they had loaded the file
+        std::shared_ptr<const SourceSamples> sharedSource = source;
+        std::shared_ptr<const IrSamples> sharedIr = ir;
+        if (shared) {
+            if (sharedSource != nullptr) {
+                sharedSource = Registry::Get().AddSource(hash, sharedSource, srcRate);
+            }
+            if (sharedIr != nullptr) {
+                Registry::IrKey key = { hash, irRate, resamplerType };
+                sharedIr = Registry::Get().AcquireIr(key, [&sharedIr]() { return sharedIr; });
+            }
+        }
 
+        std::lock_guard<std::mutex> lock(mMutex);
+        // Supersedes a load still in progress
+        mLoadPath.Set("");
+        baseIR = sharedSource;
+        mBaseSampleRate = srcRate;
+        // A changed file is hashed afresh when it is decoded again, a source
+        // stored for the old file stays private to this instance
+        mSourceHash = shared ? hash : 0;
+        mSourceStamp = shared ? stamp : Registry::FileStamp();
+        mSourceFromState = sharedSource != nullptr;
         mFilePath = filePath;
-        mDirPath = directory;
-        return 0;
+        mDirPath.Set("");
+        mLoadStats = LoadStats();
+        mLoadStats.sourceBytes = sharedSource != nullptr ? sharedSource->GetBytes() : 0;
+        if (sharedIr != nullptr) {
+            mResamplerType = (ResamplerType)resamplerType;
+        }
+
+        // A stored IR for the current rate only needs the builder
+        PostJob();
+        if (sharedIr != nullptr && irRate == mSampleRate) {
+            mJob.ir = sharedIr;
+        }
+        return pos;
+    }
+
+    // Moves the most recently staged IR into place. Returns true when Get()
+    // and GetSize() refer to a new IR that should be handed to the convolvers.
+    // Call from a single non-realtime thread (OnIdle).
+    bool Commit() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (!mIsStaged) { return false; }
+        mIR = std::move(mStagedIR);
+        mIrRate = mStagedRate;
+        mIrResamplerType = mStagedResamplerType;
+        mIsStaged = false;
+        return mIR != nullptr;
     }
 
-    WDL_FFT_REAL* Get() {
+    const WDL_FFT_REAL* Get() {
         return mIR->data();
     }
 
@@ -82,46 +334,383 @@ public:
         return mIR->size();
     }
 
+    // The committed IR, safe to call from any thread
+    std::shared_ptr<const IrSamples> GetCommitted() const {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mIR;
+    }
 
-    bool mIsStaged = false;
-private:
-    int ResampleLength(int srcLength, double srcRate, double destRate) {
-        return int(ceil(destRate / srcRate * (double)srcLength));
+    // When the source is dropped only the committed IR remains. With float
+    // FFT samples and matching rates the IR is the source buffer itself.
+    MemoryUsage GetMemoryUsage() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        MemoryUsage usage;
+        usage.staged = mStagedIR ? mStagedIR->GetBytes() : 0;
+        usage.ir = mIR ? mIR->GetBytes() : 0;
+        if (baseIR && (const void*)baseIR.get() != (const void*)mIR.get()) {
+            usage.source = baseIR->GetBytes();
+        }
+        return usage;
     }
 
-    int Resample() {
-        if ((int)mBaseSampleRate == (int)mSampleRate) {
-            unsigned long sampleCount = baseIR->size();
-            mIR = std::make_unique<std::vector<WDL_FFT_REAL>>(sampleCount);
+    void SetKeepSource(bool keepSource) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mKeepSource = keepSource;
+    }
 
-            if (mIR == nullptr) { return 1; }
+    // isCancelled is polled between blocks, a cancelled resample returns 1
+    static int Resample(const float* src, size_t srcLength, double srcRate, double dstRate, ResamplerType resamplerType, IrSamples& dst, const std::function<bool()>& isCancelled = nullptr) {
+        if ((int)srcRate == (int)dstRate) {
+            unsigned long sampleCount = srcLength;
+            dst.resize(sampleCount);
 
             for (int i = 0; i < sampleCount; i++) {
-                (*mIR)[i] = static_cast<WDL_FFT_REAL>((*baseIR)[i]);
+                dst[i] = static_cast<WDL_FFT_REAL>(src[i]);
             }
             return 0;
         }
-        switch (mResamplerType) {
+        switch (resamplerType) {
         case WDL_RESAMPLER:
-            return ResampleWDL();
+            return ResampleWDL(src, srcLength, srcRate, dstRate, dst, isCancelled);
             break;
         case R8BRAIN_RESAMPLE:
-            return ResampleR8brain();
+            return ResampleR8brain(src, srcLength, srcRate, dstRate, dst, isCancelled);
             break;
         case CUSTOM_RESAMPLE:
-            return ResampleCustom();
+            return ResampleCustom(src, srcLength, srcRate, dstRate, Resampler::kInterpolateLinear, dst, isCancelled);
+            break;
+        case CUSTOM_HQ_RESAMPLE:
+            return ResampleCustom(src, srcLength, srcRate, dstRate, Resampler::kInterpolateCubic, dst, isCancelled);
             break;
         case LINEAR_RESAMPLE:
-            return ResampleLinear();
+            return ResampleLinear(src, srcLength, srcRate, dstRate, dst, isCancelled);
             break;
         }
         return 1;
     }
 
-    int ResampleCustom() {
+    // Channel 0 of a WAV or .nzir, without the registry. Adds to the open and
+    // decode stages of stats and sets its error on failure.
+    static std::shared_ptr<const SourceSamples> Decode(const char* path, double& sampleRate, LoadStats& stats) {
+        TRACE_SCOPE("IrBuffer::Decode");
+        Clock::time_point start = Clock::now();
+        if (iplug::IrFile::IsIrFile(path)) {
+            iplug::IrFile file;
+            if (file.Open(path) != 0) {
+                stats.error = CanOpen(path) ? kLoadErrorFormat : kLoadErrorOpen;
+                return nullptr;
+            }
+            stats.openSeconds += SecondsSince(start);
+            start = Clock::now();
+            std::shared_ptr<SourceSamples> source = std::make_shared<SourceSamples>(file.GetLength());
+            if (source->size() != file.GetLength()) {
+                stats.error = kLoadErrorMemory;
+                return nullptr;
+            }
+            std::copy(file.GetSamples(), file.GetSamples() + file.GetLength(), source->data());
+            sampleRate = file.GetSampleRate();
+            stats.decodeSeconds += SecondsSince(start);
+            stats.sourceBytes = source->GetBytes();
+            return source;
+        }
+
+        HISSTools::IAudioFile file(path);
+        if (file.getIsError()) {
+            stats.error = CanOpen(path) ? kLoadErrorFormat : kLoadErrorOpen;
+            return nullptr;
+        }
+        if (file.getFrames() == 0) {
+            stats.error = kLoadErrorEmpty;
+            return nullptr;
+        }
+        stats.openSeconds += SecondsSince(start);
+        start = Clock::now();
+
+        std::shared_ptr<SourceSamples> source = std::make_shared<SourceSamples>(file.getFrames());
+        if (source->size() != file.getFrames()) {
+            stats.error = kLoadErrorMemory;
+            return nullptr;
+        }
+        file.readChannel(source->data(), file.getFrames(), 0);
+        sampleRate = file.getSamplingRate();
+        stats.decodeSeconds += SecondsSince(start);
+        stats.sourceBytes = source->GetBytes();
+        return source;
+    }
+
+private:
+    // Every request that changes the wanted IR (new file, rate or resampler)
+    // bumps mGeneration. Only the latest request is kept, so a burst of
+    // requests is coalesced into one job, and a job that is overtaken while
+    // running is abandoned and never published.
+    struct ResampleJob {
+        std::shared_ptr<const SourceSamples> source;
+        WDL_String filePath;
+        uint64_t sourceHash = 0;
+        Registry::FileStamp sourceStamp;
+        double srcRate = 0.;
+        double dstRate = 0.;
+        ResamplerType resamplerType = R8BRAIN_RESAMPLE;
+        uint32_t generation = 0;
+        bool load = false;                         // filePath is a new file from LoadIr()
+        std::shared_ptr<const IrSamples> ir;       // already built, only the builder runs
+    };
+
+    // Call with mMutex held
+    bool HasSource() const {
+        return baseIR != nullptr || mFilePath.GetLength() > 0 || mLoadPath.GetLength() > 0;
+    }
+
+    // Call with mMutex held. A pending load replaces the current source.
+    void PostJob() {
+        mJob.load = mLoadPath.GetLength() > 0;
+        mJob.source = mJob.load ? nullptr : baseIR;
+        mJob.filePath.Set(mJob.load ? mLoadPath.Get() : mFilePath.Get());
+        mJob.sourceHash = mJob.load ? 0 : mSourceHash;
+        mJob.sourceStamp = mJob.load ? Registry::FileStamp() : mSourceStamp;
+        mJob.ir = nullptr;
+        mJob.srcRate = mBaseSampleRate;
+        mJob.dstRate = mSampleRate;
+        mJob.resamplerType = mResamplerType;
+        mJob.generation = ++mGeneration;
+        mHasJob = true;
+        // A result staged for an older request is superseded as well
+        mStagedIR = nullptr;
+        mIsStaged = false;
+        mQueue->Post(this);
+    }
+
+    // Runs on a PriorityJobQueue worker, never twice at once for the same IrBuffer
+    void RunJob() {
+        TRACE_SCOPE("IrBuffer::RunJob");
+        std::unique_lock<std::mutex> lock(mMutex);
+        const bool rebuild = mRebuild;
+        mRebuild = false;
+        // A pending job builds with the latest engine choice anyway
+        if (!mHasJob) {
+            if (rebuild) {
+                RunRebuild(lock);
+            }
+            return;
+        }
+        ResampleJob job = std::move(mJob);
+        mHasJob = false;
+        const std::function<void(const IrSamples&, double)> builder = mBuilder;
+
+        lock.unlock();
+        auto isCancelled = [this, &job]() { return mGeneration.load(std::memory_order_relaxed) != job.generation; };
+        LoadStats stats;
+        bool decoded = false;
+        bool hashed = false;
+        std::shared_ptr<const IrSamples> ir = job.ir;
+        if (ir == nullptr) {
+            if (job.source == nullptr) {
+                // A new file, or a recalled one that changed since the save
+                if (job.sourceHash == 0 && job.filePath.GetLength() > 0) {
+                    const Clock::time_point start = Clock::now();
+                    job.sourceStamp = Registry::StampFile(job.filePath.Get());
+                    job.sourceHash = Registry::HashFile(job.filePath.Get(), &stats.fileBytes);
+                    stats.openSeconds = SecondsSince(start);
+                    hashed = true;
+                }
+                job.source = AcquireSource(job.filePath.Get(), job.sourceHash, job.srcRate, stats);
+                decoded = true;
+            }
+            ir = Build(job, isCancelled, stats);
+        }
+        if (ir != nullptr && builder && !isCancelled()) {
+            const Clock::time_point start = Clock::now();
+            builder(*ir, job.dstRate);
+            stats.buildSeconds = SecondsSince(start);
+        }
+        lock.lock();
+
+        if (job.generation != mGeneration) { return; }
+        if (ir == nullptr) {
+            mLoadStats.error = stats.error != kLoadOk ? stats.error : kLoadErrorResample;
+            mError = mLoadStats.error;
+            if (job.load) {
+                mLoadPath.Set("");
+            }
+            return;
+        }
+        if (job.load) {
+            mFilePath = job.filePath;
+            mDirPath = mLoadDirectory;
+            mLoadPath.Set("");
+            mSourceFromState = false;
+            baseIR = nullptr;
+            mLoadStats = LoadStats();
+        }
+        if (hashed) {
+            mLoadStats.fileBytes = stats.fileBytes;
+        }
+        if (decoded) {
+            mSourceHash = job.sourceHash;
+            mSourceStamp = job.sourceStamp;
+            mBaseSampleRate = job.srcRate;
+            mLoadStats.openSeconds = stats.openSeconds;
+            mLoadStats.decodeSeconds = stats.decodeSeconds;
+            mLoadStats.sourceBytes = stats.sourceBytes;
+            mLoadStats.sharedSource = stats.sharedSource;
+        }
+        mLoadStats.error = kLoadOk;
+        mLoadStats.resampleSeconds = stats.resampleSeconds;
+        mLoadStats.buildSeconds = stats.buildSeconds;
+        mLoadStats.irBytes = ir->GetBytes();
+        mLoadStats.sharedIr = stats.sharedIr;
+        mLoadStats.prebuilt = stats.prebuilt;
+        mStagedIR = std::move(ir);
+        mStagedRate = job.dstRate;
+        mStagedResamplerType = job.resamplerType;
+        mIsStaged = true;
+
+        if (decoded && mKeepSource) {
+            baseIR = job.source;
+        }
+        // The file can be decoded again if a later rate or resampler change needs it.
+        // A source recalled from the state is kept, its file may have moved.
+        else if (!mKeepSource && !mSourceFromState && mFilePath.GetLength() > 0) {
+            baseIR = nullptr;
+        }
+    }
+
+    // Call with mMutex held, which is released while the builder runs
+    void RunRebuild(std::unique_lock<std::mutex>& lock) {
+        std::shared_ptr<const IrSamples> ir = mIR;
+        const double sampleRate = mIrRate;
+        const ResamplerType resamplerType = mIrResamplerType;
+        const uint32_t generation = mGeneration;
+        const std::function<void(const IrSamples&, double)> builder = mBuilder;
+        if (ir == nullptr || !builder) { return; }
+
+        lock.unlock();
+        const Clock::time_point start = Clock::now();
+        builder(*ir, sampleRate);
+        const double seconds = SecondsSince(start);
+        lock.lock();
+
+        // A newer IR is on its way and gets reported instead
+        if (generation != mGeneration || mIsStaged) { return; }
+        mLoadStats.buildSeconds = seconds;
+        mStagedIR = std::move(ir);
+        mStagedRate = sampleRate;
+        mStagedResamplerType = resamplerType;
+        mIsStaged = true;
+    }
+
+    // The file is only decoded when no other instance holds it already
+    static std::shared_ptr<const SourceSamples> AcquireSource(const char* path, uint64_t hash, double& sampleRate, LoadStats& stats) {
+        if (hash == 0) {
+            return Decode(path, sampleRate, stats);
+        }
+        std::shared_ptr<const SourceSamples> source = Registry::Get().FindSource(hash, sampleRate);
+        if (source != nullptr) {
+            stats.sharedSource = true;
+            stats.sourceBytes = source->GetBytes();
+            return source;
+        }
+        source = Decode(path, sampleRate, stats);
+        if (source == nullptr) {
+            return nullptr;
+        }
+        return Registry::Get().AddSource(hash, source, sampleRate);
+    }
+
+    static std::shared_ptr<const IrSamples> Build(const ResampleJob& job, const std::function<bool()>& isCancelled, LoadStats& stats) {
+        if (job.source == nullptr) {
+            return nullptr;
+        }
+        if (job.sourceHash == 0) {
+            return BuildIr(job, isCancelled, stats);
+        }
+
+        Registry::IrKey key = { job.sourceHash, job.dstRate, (int)job.resamplerType };
+        bool built = false;
+        std::shared_ptr<const IrSamples> ir = Registry::Get().AcquireIr(key, [&job, &isCancelled, &stats, &built]() {
+            built = true;
+            return BuildIr(job, isCancelled, stats);
+        }, isCancelled);
+        stats.sharedIr = ir != nullptr && !built;
+        return ir;
+    }
+
+    static std::shared_ptr<const IrSamples> BuildIr(const ResampleJob& job, const std::function<bool()>& isCancelled, LoadStats& stats) {
+        if ((int)job.srcRate == (int)job.dstRate) {
+            std::shared_ptr<const IrSamples> shared = ShareSource(job.source);
+            if (shared != nullptr) {
+                return shared;
+            }
+        }
+
+        Clock::time_point start = Clock::now();
+        std::shared_ptr<const IrSamples> prebuilt = LoadPrebuilt(job);
+        if (prebuilt != nullptr) {
+            stats.prebuilt = true;
+            stats.resampleSeconds = SecondsSince(start);
+            return prebuilt;
+        }
+
+        start = Clock::now();
+        std::shared_ptr<IrSamples> ir = std::make_shared<IrSamples>();
+        if (Resample(job.source->data(), job.source->size(), job.srcRate, job.dstRate, job.resamplerType, *ir, isCancelled) != 0) {
+            stats.error = kLoadErrorResample;
+            return nullptr;
+        }
+        stats.resampleSeconds = SecondsSince(start);
+        return ir;
+    }
+
+    // A sibling .nzir for the wanted rate and resampler. When a WAV was loaded
+    // the file must also have been built from that very WAV.
+    static std::shared_ptr<const IrSamples> LoadPrebuilt(const ResampleJob& job) {
+        if (job.filePath.GetLength() == 0) {
+            return nullptr;
+        }
+        TRACE_SCOPE("IrBuffer::LoadPrebuilt");
+        iplug::IrFile file;
+        if (file.Open(iplug::IrFile::MakePath(job.filePath.Get(), job.dstRate).c_str()) != 0) {
+            return nullptr;
+        }
+        const iplug::IrFile::Header& header = file.GetHeader();
+        if ((int)header.sampleRate != (int)job.dstRate || header.resamplerType != (int)job.resamplerType) {
+            return nullptr;
+        }
+        if (!iplug::IrFile::IsIrFile(job.filePath.Get()) && (job.sourceHash == 0 || header.sourceHash != job.sourceHash)) {
+            return nullptr;
+        }
+
+        std::shared_ptr<IrSamples> ir = std::make_shared<IrSamples>(file.GetLength());
+        if (ir->size() != file.GetLength()) {
+            return nullptr;
+        }
+        std::copy(file.GetSamples(), file.GetSamples() + file.GetLength(), ir->data());
+        return ir;
+    }
+
+    // With float FFT samples an IR at the source rate is the source buffer itself
+    static std::shared_ptr<const IrSamples> ShareSource(const std::shared_ptr<const IrSamples>& source) {
+        return source;
+    }
+
+    template <typename T>
+    static std::shared_ptr<const IrSamples> ShareSource(const std::shared_ptr<const AlignedBuffer<T>>& source) {
+        return nullptr;
+    }
+
+    static int ResampleLength(int srcLength, double srcRate, double destRate) {
+        return int(ceil(destRate / srcRate * (double)srcLength));
+    }
+
+    static int ResampleCustom(const float* src, size_t srcLength, double srcRate, double dstRate, Resampler::Interpolation interpolation, IrSamples& dst, const std::function<bool()>& isCancelled) {
+        TRACE_SCOPE("IrBuffer::ResampleCustom");
         unsigned long outLength = 0;
         Resampler resampler;
-        float* temp = resampler.process(baseIR->data(), baseIR->size(), outLength, mBaseSampleRate, mSampleRate);
+        resampler.setInterpolation(interpolation);
+        // Bit-identical to one thread, see Resampler::setJobQueue(). Idle
+        // queue workers help, the convolver tails' pool is never used.
+        resampler.setJobQueue(PriorityJobQueue::Get());
+        float* temp = resampler.process(const_cast<float*>(src), srcLength, outLength, srcRate, dstRate, 1.0, isCancelled);
         if (outLength == 0) {
             if (temp != NULL) {
                 delete[] temp;
@@ -129,33 +718,34 @@ private:
             return 1;
         }
 
-        mIR = std::make_unique<std::vector<WDL_FFT_REAL>>(outLength);
+        dst.resize(outLength);
 
         for (unsigned long i = 0; i < outLength; i++) {
-            (*mIR)[i] = static_cast<WDL_FFT_REAL>(temp[i]);
+            dst[i] = static_cast<WDL_FFT_REAL>(temp[i]);
         }
 
         delete[] temp;
         return 0;
     }
-    int ResampleWDL() {
+
+    static int ResampleWDL(const float* src, size_t srcLength, double srcRate, double dstRate, IrSamples& dst, const std::function<bool()>& isCancelled) {
+        TRACE_SCOPE("IrBuffer::ResampleWDL");
         WDL_Resampler resampler;
-        double srcRate = mBaseSampleRate;
-        double dstRate = mSampleRate;
         constexpr unsigned long blockLength = 64;
 
 
-        unsigned long srcLength = baseIR->size();
         unsigned long dstLength = ResampleLength(srcLength, srcRate, dstRate);
-        std::unique_ptr<std::vector<WDL_FFT_REAL>> tempBuff = std::make_unique<std::vector<WDL_FFT_REAL>>(dstLength);
-        float* pSrc = baseIR->data();
-        WDL_FFT_REAL* pDest = tempBuff->data();
+        dst.resize(dstLength);
+        const float* pSrc = src;
+        WDL_FFT_REAL* pDest = dst.data();
 
         resampler.SetRates(srcRate, dstRate);
         resampler.SetFeedMode(true);
         double scale = srcRate / dstRate;
 
         while (dstLength > 0) {
+            if (isCancelled && isCancelled()) { return 1; }
+
             WDL_ResampleSample* p;
             int n = resampler.ResamplePrepare(blockLength, 1, &p);
             int m = n;
@@ -183,26 +773,22 @@ private:
             dstLength -= n;
         }
         resampler.Reset();
-        mIR = std::move(tempBuff);
 
         return 0;
     }
 
-    int ResampleLinear() {
-        WDL_Resampler resampler;
-        double srcRate = mBaseSampleRate;
-        double dstRate = mSampleRate;
-
-
-        unsigned long srcLength = baseIR->size();
+    static int ResampleLinear(const float* src, size_t srcLength, double srcRate, double dstRate, IrSamples& dst, const std::function<bool()>& isCancelled) {
+        TRACE_SCOPE("IrBuffer::ResampleLinear");
         unsigned long dstLength = ResampleLength(srcLength, srcRate, dstRate);
-        std::unique_ptr<std::vector<WDL_FFT_REAL>> tempBuff = std::make_unique<std::vector<WDL_FFT_REAL>>(dstLength);
-        float* pSrc = baseIR->data();
-        WDL_FFT_REAL* pDest = tempBuff->data();
+        dst.resize(dstLength);
+        const float* pSrc = src;
+        WDL_FFT_REAL* pDest = dst.data();
 
         double pos = 0.;
         double delta = srcRate / dstRate;
         for (int i = 0; i < dstLength; ++i) {
+            if ((i & (kCancelCheckInterval - 1)) == 0 && isCancelled && isCancelled()) { return 1; }
+
             int idx = int(pos);
             if (idx < srcLength) {
                 double frac = pos - floor(pos);
@@ -215,16 +801,15 @@ private:
                 *pDest++ = 0;
             }
         }
-        mIR = std::move(tempBuff);
 
         return 0;
     }
 
-    int ResampleR8brain() {
-        double srcRate = mBaseSampleRate;
-        double dstRate = mSampleRate;
-        unsigned long srcLength = baseIR->size();
-        float* pSrc = baseIR->data();
+    static int ResampleR8brain(const float* src, size_t srcLength, double srcRate, double dstRate, IrSamples& dst, const std::function<bool()>& isCancelled) {
+        TRACE_SCOPE("IrBuffer::ResampleR8brain");
+        // An empty source would feed zero-length blocks that never produce output
+        if (srcLength == 0) { return 1; }
+        const float* pSrc = src;
 
         std::unique_ptr<CDSPResampler16IR> resampler = std::make_unique<CDSPResampler16IR>(srcRate, dstRate, srcLength);
         unsigned long dstLength = resampler->getMaxOutLen(0);
@@ -233,21 +818,98 @@ private:
             return 1;
         }
 
-        std::unique_ptr<std::vector<WDL_FFT_REAL>> tempBuff = std::make_unique<std::vector<WDL_FFT_REAL>>(dstLength);
-        resampler->oneshot(pSrc, srcLength, tempBuff->data(), dstLength);
+        dst.resize(dstLength);
 
+        // Same as CDSPResampler::oneshot(), fed in blocks so it can be cancelled
+        const int blockLength = (int)wdl_min(srcLength, (unsigned long)kCancelCheckInterval);
+        std::vector<double> inBuf(blockLength);
+        WDL_FFT_REAL* pDest = dst.data();
+        unsigned long remaining = dstLength;
+        while (remaining > 0) {
+            if (isCancelled && isCancelled()) { return 1; }
 
-        WDL_FFT_REAL* pDest = tempBuff->data();
-        mIR = std::move(tempBuff);
+            int n = (int)wdl_min(srcLength, (unsigned long)blockLength);
+            for (int i = 0; i < n; i++) {
+                inBuf[i] = pSrc[i];
+            }
+            // Past the end of the source keep feeding zeros to flush the filter
+            if (n < blockLength) {
+                memset(inBuf.data() + n, 0, (blockLength - n) * sizeof(double));
+            }
+            pSrc += n;
+            srcLength -= n;
+
+            double* out;
+            int written = resampler->process(inBuf.data(), blockLength, out);
+            written = (int)wdl_min((unsigned long)written, remaining);
+            for (int i = 0; i < written; i++) {
+                *pDest++ = static_cast<WDL_FFT_REAL>(out[i]);
+            }
+            remaining -= written;
+        }
 
         return 0;
     }
 
+    typedef std::chrono::steady_clock Clock;
+
+    static double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    static bool CanOpen(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) { return false; }
+        fclose(file);
+        return true;
+    }
+
+    static constexpr int kCancelCheckInterval = 4096;
+    static constexpr int kStateVersion = 3;
+
+    template <typename T>
+    static void PutSamples(iplug::IByteChunk& chunk, const AlignedBuffer<T>& samples) {
+        const int length = (int)samples.size();
+        chunk.Put(&length);
+        chunk.PutBytes(samples.data(), length * (int)sizeof(T));
+    }
+
+    template <typename T>
+    static int GetSamples(const iplug::IByteChunk& chunk, AlignedBuffer<T>& samples, int pos) {
+        int length = 0;
+        pos = chunk.Get(&length, pos);
+        if (pos < 0 || length < 0 || length > (chunk.Size() - pos) / (int)sizeof(T)) { return -1; }
+        samples.resize(length);
+        if (samples.size() != (size_t)length) { return -1; }
+        return chunk.GetBytes(samples.data(), length * (int)sizeof(T), pos);
+    }
+
     double mSampleRate = 0.;
     double mBaseSampleRate = 0.;
-    std::unique_ptr<std::vector<float>> baseIR;
-    std::unique_ptr<std::vector<WDL_FFT_REAL>> mIR;
+    std::shared_ptr<const SourceSamples> baseIR;
+    uint64_t mSourceHash = 0;
+    Registry::FileStamp mSourceStamp;
+    bool mSourceFromState = false;
+    std::shared_ptr<const IrSamples> mIR;
+    std::shared_ptr<const IrSamples> mStagedIR;
+    double mIrRate = 0.;
+    double mStagedRate = 0.;
+    ResamplerType mIrResamplerType = R8BRAIN_RESAMPLE;
+    ResamplerType mStagedResamplerType = R8BRAIN_RESAMPLE;
+    bool mKeepSource = false;
+    bool mIsStaged = false;
+    ResampleJob mJob;
+    bool mHasJob = false;
+    LoadStats mLoadStats;
+    LoadError mError = kLoadOk;
+    std::function<void(const IrSamples&, double)> mBuilder;
+    bool mRebuild = false;
+    std::atomic<uint32_t> mGeneration{ 0 };
+    mutable std::mutex mMutex;
     WDL_String mFilePath;
     WDL_String mDirPath;
+    WDL_String mLoadPath;          // a file LoadIr() handed to the worker, until it is built
+    WDL_String mLoadDirectory;
     ResamplerType mResamplerType;
+    std::shared_ptr<PriorityJobQueue> mQueue;
 };
@@ -0,0 +1,234 @@
+#pragma once
+
+#include "MultichannelConvolver.h"
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+BEGIN_IPLUG_NAMESPACE
+
+// NeZcab's binary IR file (.nzir): one IR already resampled to one rate,
+// plus its MultichannelConvolver partition spectra for one block size.
+// A fixed 64 byte header is followed by the samples and the spectra (all
+// real parts, then all imaginary parts), each starting on a kAlignment
+// boundary, so a read-only mapping of the file is used in place:
+// the samples skip WAV parsing and resampling, the spectra skip the FFTs.
+// Files are written in native (little-endian) byte order.
+class IrFile {
+public:
+    static constexpr uint32_t kVersion = 1;
+    static constexpr size_t kAlignment = 64;
+
+    struct Header {
+        char magic[4];             // "NZIR"
+        uint32_t version;
+        double sampleRate;
+        uint64_t sourceHash;       // IrRegistry::HashFile() of the WAV it was built from
+        int32_t resamplerType;     // IrBuffer::ResamplerType
+        uint32_t blockSize;        // partition size of the spectra
+        uint64_t length;           // samples
+        uint32_t numPartitions;
+        uint32_t numBins;          // per partition, MultichannelConvolver::GetNumBins()
+        uint64_t samplesOffset;    // bytes from the start of the file
+        uint64_t spectraOffset;
+    };
+    static_assert(sizeof(Header) == 64, "IrFile header layout changed");
+
+    IrFile() {}
+    ~IrFile() {
+        Close();
+    }
+    IrFile(const IrFile&) = delete;
+    IrFile& operator=(const IrFile&) = delete;
+
+    // Maps the file, returns 0 on success
+    int Open(const char* path) {
+        Close();
+        if (!Map(path)) { return 1; }
+        if (!IsValid()) {
+            Close();
+            return 1;
+        }
+        return 0;
+    }
+
+    void Close() {
+        if (mData == nullptr) { return; }
+#if defined(_WIN32)
+        UnmapViewOfFile(mData);
+#else
+        munmap(mData, mSize);
+#endif
+        mData = nullptr;
+        mSize = 0;
+    }
+
+    const Header& GetHeader() const {
+        return *reinterpret_cast<const Header*>(mData);
+    }
+
+    double GetSampleRate() const {
+        return GetHeader().sampleRate;
+    }
+
+    size_t GetLength() const {
+        return (size_t)GetHeader().length;
+    }
+
+    const float* GetSamples() const {
+        return reinterpret_cast<const float*>(static_cast<const char*>(mData) + GetHeader().samplesOffset);
+    }
+
+    const float* GetSpectraRe() const {
+        return reinterpret_cast<const float*>(static_cast<const char*>(mData) + GetHeader().spectraOffset);
+    }
+
+    const float* GetSpectraIm() const {
+        return GetSpectraRe() + GetSpectrumSize(GetHeader());
+    }
+
+    // Returns 0 on success
+    template <typename T>
+    static int Write(const char* path, const T* ir, size_t length, double sampleRate, int resamplerType, uint64_t sourceHash,
+        size_t blockSize = MultichannelConvolver::kDefaultBlockSize) {
+        if (length == 0 || blockSize == 0) { return 1; }
+        Header header = {};
+        memcpy(header.magic, kMagic, sizeof(header.magic));
+        header.version = kVersion;
+        header.sampleRate = sampleRate;
+        header.sourceHash = sourceHash;
+        header.resamplerType = resamplerType;
+        header.blockSize = (uint32_t)blockSize;
+        header.length = length;
+        header.numPartitions = (uint32_t)MultichannelConvolver::GetNumPartitions(length, blockSize);
+        header.numBins = (uint32_t)MultichannelConvolver::GetNumBins(blockSize);
+        header.samplesOffset = Align(sizeof(Header));
+        header.spectraOffset = Align(header.samplesOffset + length * sizeof(float));
+
+        const std::vector<float> samples(ir, ir + length);
+        const size_t spectrumSize = GetSpectrumSize(header);
+        std::vector<float> spectra(2 * spectrumSize);
+        if (MultichannelConvolver::ComputeSpectra(samples.data(), length, blockSize, spectra.data(), spectra.data() + spectrumSize) != 0) { return 1; }
+
+        FILE* f = fopen(path, "wb");
+        if (f == nullptr) { return 1; }
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+        ok = ok && WritePadding(f, header.samplesOffset - sizeof(header));
+        ok = ok && fwrite(samples.data(), sizeof(float), length, f) == length;
+        ok = ok && WritePadding(f, header.spectraOffset - header.samplesOffset - length * sizeof(float));
+        ok = ok && fwrite(spectra.data(), sizeof(float), spectra.size(), f) == spectra.size();
+        ok = fclose(f) == 0 && ok;
+        if (!ok) {
+            remove(path);
+        }
+        return ok ? 0 : 1;
+    }
+
+    static bool IsIrFile(const char* path) {
+        const size_t length = strlen(path);
+        const size_t extension = strlen(kExtension);
+        return length >= extension && strcmp(path + length - extension, kExtension) == 0;
+    }
+
+    // <name>.<rate>.nzir next to <name>.wav, or next to another rate's <name>.<rate>.nzir
+    static std::string MakePath(const char* path, double sampleRate) {
+        std::string base(path);
+        const bool isIrFile = IsIrFile(path);
+        size_t dot = base.find_last_of('.');
+        const size_t slash = base.find_last_of("/\\");
+        if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+            base.erase(dot);
+        }
+        if (isIrFile) {
+            dot = base.find_last_of('.');
+            if (dot != std::string::npos && (slash == std::string::npos || dot > slash)) {
+                base.erase(dot);
+            }
+        }
+        char rate[32];
+        snprintf(rate, sizeof(rate), ".%d", (int)(sampleRate + 0.5));
+        return base + rate + kExtension;
+    }
+
+private:
+    static constexpr const char* kMagic = "NZIR";
+    static constexpr const char* kExtension = ".nzir";
+
+    static uint64_t Align(uint64_t offset) {
+        return (offset + kAlignment - 1) & ~(uint64_t)(kAlignment - 1);
+    }
+
+    static size_t GetSpectrumSize(const Header& header) {
+        return (size_t)header.numPartitions * header.numBins;
+    }
+
+    static bool WritePadding(FILE* f, size_t bytes) {
+        const char zeros[kAlignment] = {};
+        return bytes == 0 || fwrite(zeros, 1, bytes, f) == bytes;
+    }
+
+    // Every offset and size is checked against the mapped size before it is used
+    bool IsValid() const {
+        if (mSize < sizeof(Header)) { return false; }
+        const Header& header = GetHeader();
+        if (memcmp(header.magic, kMagic, sizeof(header.magic)) != 0 || header.version != kVersion) { return false; }
+        if (header.length == 0 || header.blockSize == 0 || header.sampleRate <= 0.) { return false; }
+        if (header.numPartitions != MultichannelConvolver::GetNumPartitions((size_t)header.length, header.blockSize) ||
+            header.numBins != MultichannelConvolver::GetNumBins(header.blockSize)) { return false; }
+        if (header.samplesOffset % kAlignment != 0 || header.spectraOffset % kAlignment != 0) { return false; }
+        if (header.samplesOffset < sizeof(Header) || header.samplesOffset > mSize ||
+            header.length > (mSize - header.samplesOffset) / sizeof(float)) { return false; }
+        if (header.spectraOffset < header.samplesOffset + header.length * sizeof(float) || header.spectraOffset > mSize ||
+            2 * GetSpectrumSize(header) > (mSize - header.spectraOffset) / sizeof(float)) { return false; }
+        return true;
+    }
+
+    bool Map(const char* path) {
+#if defined(_WIN32)
+        wchar_t widePath[1024];
+        if (MultiByteToWideChar(CP_UTF8, 0, path, -1, widePath, 1024) == 0) { return false; }
+        HANDLE file = CreateFileW(widePath, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) { return false; }
+        LARGE_INTEGER size;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+            mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        if (mapping != nullptr) {
+            mData = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            mSize = mData != nullptr ? (size_t)size.QuadPart : 0;
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+#else
+        const int file = open(path, O_RDONLY);
+        if (file < 0) { return false; }
+        struct stat info;
+        if (fstat(file, &info) == 0 && info.st_size > 0) {
+            void* data = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (data != MAP_FAILED) {
+                mData = data;
+                mSize = (size_t)info.st_size;
+            }
+        }
+        close(file);
+#endif
+        return mData != nullptr;
+    }
+
+    void* mData = nullptr;
+    size_t mSize = 0;
+};
+
+END_IPLUG_NAMESPACE
@@ -0,0 +1,201 @@
+#pragma once
+
+#include "AlignedBuffer.h"
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+// Process-wide cache of decoded and resampled IRs, shared by every plugin
+// instance. Entries are keyed by the content hash of the source file, so
+// identical IRs are decoded and resampled once per process no matter how
+// many instances load them. The registry only holds weak references, an
+// entry lives as long as some instance still uses it.
+template <typename SourceSamples, typename IrSamples>
+class IrRegistry {
+public:
+    struct SourceKey {
+        uint64_t hash;
+
+        bool operator<(const SourceKey& other) const {
+            return hash < other.hash;
+        }
+    };
+
+    struct IrKey {
+        uint64_t hash;
+        double sampleRate;
+        int resampler;
+
+        bool operator<(const IrKey& other) const {
+            if (hash != other.hash) { return hash < other.hash; }
+            if (sampleRate != other.sampleRate) { return sampleRate < other.sampleRate; }
+            return resampler < other.resampler;
+        }
+    };
+
+    struct SourceEntry {
+        std::weak_ptr<const SourceSamples> samples;
+        double sampleRate = 0.;
+    };
+
+    // Size and modification time, a cheap check that a file hasn't changed since it was hashed
+    struct FileStamp {
+        uint64_t size = 0;
+        int64_t modified = 0;
+
+        bool IsValid() const {
+            return size > 0;
+        }
+
+        bool operator==(const FileStamp& other) const {
+            return size == other.size && modified == other.modified;
+        }
+    };
+
+    static IrRegistry& Get() {
+        static IrRegistry registry;
+        return registry;
+    }
+
+    // FNV-1a, 0 if the file can't be read. bytes receives the file size.
+    static uint64_t HashFile(const char* path, size_t* bytes = nullptr) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) { return 0; }
+
+        uint64_t hash = kHashSeed;
+        unsigned char buffer[65536];
+        size_t read;
+        size_t total = 0;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+            hash = HashBytes(buffer, read, hash);
+            total += read;
+        }
+        fclose(file);
+        if (bytes != nullptr) {
+            *bytes = total;
+        }
+        return hash;
+    }
+
+    // Invalid if the file can't be found
+    static FileStamp StampFile(const char* path) {
+        FileStamp stamp;
+#if defined(_WIN32)
+        struct _stat64 info;
+        if (_stat64(path, &info) != 0) { return stamp; }
+#else
+        struct stat info;
+        if (stat(path, &info) != 0) { return stamp; }
+#endif
+        stamp.size = (uint64_t)info.st_size;
+        stamp.modified = (int64_t)info.st_mtime;
+        return stamp;
+    }
+
+    static uint64_t HashBytes(const void* data, size_t size, uint64_t hash = kHashSeed) {
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for (size_t i = 0; i < size; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+        }
+        return hash;
+    }
+
+    std::shared_ptr<const SourceSamples> FindSource(uint64_t hash, double& sampleRate) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mSources.find(SourceKey{ hash });
+        if (it == mSources.end()) { return nullptr; }
+
+        std::shared_ptr<const SourceSamples> source = it->second.samples.lock();
+        if (source != nullptr) {
+            sampleRate = it->second.sampleRate;
+        }
+        return source;
+    }
+
+    // Returns the registered source, which is an earlier one when another instance got there first
+    std::shared_ptr<const SourceSamples> AddSource(uint64_t hash, std::shared_ptr<const SourceSamples> source, double& sampleRate) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        SourceEntry& entry = mSources[SourceKey{ hash }];
+        if (std::shared_ptr<const SourceSamples> existing = entry.samples.lock()) {
+            sampleRate = entry.sampleRate;
+            return existing;
+        }
+        entry.samples = source;
+        entry.sampleRate = sampleRate;
+        Prune();
+        return source;
+    }
+
+    // Returns the shared IR for key, running make() if no instance has built it yet.
+    // When another instance is already building the same IR this waits for it
+    // instead of doing the work twice. make() may return nullptr (cancelled).
+    std::shared_ptr<const IrSamples> AcquireIr(const IrKey& key, const std::function<std::shared_ptr<const IrSamples>()>& make,
+        const std::function<bool()>& isCancelled = nullptr) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true) {
+            auto it = mIrs.find(key);
+            if (it != mIrs.end()) {
+                if (std::shared_ptr<const IrSamples> ir = it->second.lock()) {
+                    return ir;
+                }
+            }
+            if (mBuilding.count(key) == 0) { break; }
+            if (isCancelled && isCancelled()) { return nullptr; }
+            mCondition.wait_for(lock, std::chrono::milliseconds(10));
+        }
+
+        mBuilding.insert(key);
+        lock.unlock();
+        std::shared_ptr<const IrSamples> ir = make();
+        lock.lock();
+        mBuilding.erase(key);
+
+        if (ir != nullptr) {
+            mIrs[key] = ir;
+            Prune();
+        }
+        mCondition.notify_all();
+        return ir;
+    }
+
+    size_t GetNumSources() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Prune();
+        return mSources.size();
+    }
+
+    size_t GetNumIrs() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Prune();
+        return mIrs.size();
+    }
+
+private:
+    static constexpr uint64_t kHashSeed = 0xcbf29ce484222325ULL;
+
+    IrRegistry() {}
+
+    // Call with mMutex held
+    void Prune() {
+        for (auto it = mSources.begin(); it != mSources.end();) {
+            it = it->second.samples.expired() ? mSources.erase(it) : std::next(it);
+        }
+        for (auto it = mIrs.begin(); it != mIrs.end();) {
+            it = it->second.expired() ? mIrs.erase(it) : std::next(it);
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::map<SourceKey, SourceEntry> mSources;
+    std::map<IrKey, std::weak_ptr<const IrSamples>> mIrs;
+    std::set<IrKey> mBuilding;
+};
@@ -0,0 +1,534 @@
+#pragma once
+
+#include "RealFFT.h"
+#include "IPlugConstants.h"
+#include "AlignedArena.h"
+#include "AH_VectorOps.h"
+#include "Trace.h"
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Uniformly partitioned (overlap-save) convolution of every channel with the
+// same IR. The frequency-domain delay line keeps the channels of each bin
+// next to each other, so the multiply-accumulate runs across channels in
+// SIMD lanes and every IR spectrum value is loaded once for all channels.
+// IR spectra and delay line are split into tiles of bins, each holding all
+// partitions of its bins, so the multiply-accumulate runs one tile at a
+// time: its sums stay in L1 while the partitions stream through in order.
+// Latency is one block. A new IR is built into the spare state and swapped
+// in under a lock the audio thread only ever try-locks, like WdlConvolver.
+// The replaced state becomes the next spare, and all buffers of a state
+// live in one arena, so browsing IRs of similar length doesn't allocate.
+// Host blocks shorter than the partition would otherwise leave all the work
+// to the call that completes a block, see Scheduling for how it is spread.
+class MultichannelConvolver {
+public:
+    static constexpr size_t kDefaultBlockSize = 512;
+    // Sums of one tile (all lanes, re and im) fit in this many bytes
+    static constexpr size_t kTileBytes = 4096;
+
+    // What runs on the call that completes a block, the rest is paced over
+    // the calls that buffer the next block
+    enum Scheduling {
+        kScheduleAtBlock = 0,  // everything
+        kScheduleSpread,       // the newest input's FFT and partition and the inverse FFT
+        kScheduleDeferred      // nothing, the output comes one block later (latency 2 x blockSize)
+    };
+
+    MultichannelConvolver(int numChannels = 2, size_t blockSize = kDefaultBlockSize, Scheduling scheduling = kScheduleSpread) :
+        mNumChannels(numChannels),
+        mBlockSize(blockSize),
+        mScheduling(scheduling)
+    {}
+    ~MultichannelConvolver() {}
+
+    void OnReset() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mState != nullptr) {
+            mState->Reset(mNumChannels, mBlockSize, mScheduling);
+        }
+    }
+
+    // Off lays out whole partitions one after the other, for benchmarks. Takes effect on the next SetIr().
+    void SetTiled(bool tiled) {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        mTiled = tiled;
+    }
+
+    // Takes effect on the next SetIr(), spectra don't depend on the backend
+    void SetFFTBackend(RealFFT::Backend backend) {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        mFFTBackend = backend;
+    }
+
+    int SetIr(const float* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    int SetIr(const double* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    // Starts from partition spectra computed by ComputeSpectra() for the same
+    // block size (e.g. read from an IrFile), no FFTs are run
+    int SetSpectra(const float* re, const float* im, size_t numPartitions, size_t blockSize) {
+        TRACE_SCOPE("MultichannelConvolver::SetSpectra");
+        if (numPartitions == 0 || blockSize != mBlockSize || mNumChannels < 1) { return 1; }
+
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        State* state = Prepare(numPartitions);
+        if (state == nullptr) { return 1; }
+        for (size_t p = 0; p < numPartitions; p++) {
+            state->SetPartition(p, re + p * state->numBins, im + p * state->numBins);
+        }
+        Publish();
+        return 0;
+    }
+
+    static size_t GetNumPartitions(size_t length, size_t blockSize) {
+        return (length + blockSize - 1) / blockSize;
+    }
+
+    // Complex bins per partition, fftSize / 2 + 1 padded to whole vectors
+    static size_t GetNumBins(size_t blockSize) {
+        return (blockSize + 1 + 3) & ~(size_t)3;
+    }
+
+    // Fills re and im with GetNumPartitions() x GetNumBins() values each, [partition][bin].
+    // Returns 0 on success.
+    template <typename T>
+    static int ComputeSpectra(const T* ir, size_t length, size_t blockSize, float* re, float* im) {
+        RealFFT fft;
+        if (fft.Init(2 * blockSize) != 0) { return 1; }
+        std::vector<float> time(2 * blockSize);
+        const size_t numBins = GetNumBins(blockSize);
+        for (size_t p = 0; p < GetNumPartitions(length, blockSize); p++) {
+            Partition(fft, time.data(), ir, length, blockSize, p, re + p * numBins, im + p * numBins);
+        }
+        return 0;
+    }
+
+    int GetLatency() const {
+        return (int)(mScheduling == kScheduleDeferred ? 2 * mBlockSize : mBlockSize);
+    }
+
+    int GetNumChannels() const {
+        return mNumChannels;
+    }
+
+    size_t GetMemoryUsage() const {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        return (mState != nullptr ? mState->arena.GetCapacity() : 0) + (mSpare != nullptr ? mSpare->arena.GetCapacity() : 0);
+    }
+
+    // inputs and outputs hold GetNumChannels() channels, they may be the same buffers
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("MultichannelConvolver::process");
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (!lock.owns_lock() || mState == nullptr) {
+            for (int c = 0; c < mNumChannels; c++) {
+                if (outputs[c] != inputs[c]) {
+                    std::copy(inputs[c], inputs[c] + nFrames, outputs[c]);
+                }
+            }
+            return;
+        }
+
+        State& state = *mState;
+        const size_t fftSize = 2 * mBlockSize;
+        int done = 0;
+        while (done < nFrames) {
+            const int n = (int)std::min((size_t)(nFrames - done), mBlockSize - state.position);
+            for (int c = 0; c < mNumChannels; c++) {
+                float* in = state.input + c * fftSize + mBlockSize + state.position;
+                const float* out = state.output + c * mBlockSize + state.position;
+                for (int s = 0; s < n; s++) {
+                    in[s] = (float)inputs[c][done + s];
+                    outputs[c][done + s] = (iplug::sample)out[s];
+                }
+            }
+            state.position += n;
+            done += n;
+            if (state.position == mBlockSize) {
+                ProcessBlock(state);
+                state.position = 0;
+            }
+            else {
+                RunSteps(state, state.numSteps * state.position / mBlockSize);
+            }
+        }
+    }
+
+private:
+    // Everything one IR needs, built outside the audio thread and swapped in whole
+    struct State {
+        size_t numPartitions = 0;
+        size_t numBins = 0;      // fftSize / 2 + 1, padded to whole vectors
+        size_t numLanes = 0;     // channels per bin in the delay line
+        size_t tileBins = 0;     // bins per tile, a multiple of 4
+        size_t current = 0;      // delay line slot of the newest input spectrum
+        size_t position = 0;     // samples of the current block already buffered
+        size_t step = 0;         // paced steps done for the pending block
+        size_t numSteps = 0;
+        AlignedArena arena;
+        float* irRe = nullptr;       // [tile][partition][bin of the tile]
+        float* irIm = nullptr;
+        float* delayRe = nullptr;    // [tile][slot][bin of the tile][lane]
+        float* delayIm = nullptr;
+        float* sumRe = nullptr;      // [bin][lane]
+        float* sumIm = nullptr;
+        float* input = nullptr;      // [channel][fftSize], the last two blocks
+        float* output = nullptr;     // [channel][blockSize]
+        float* frame = nullptr;      // [channel][fftSize], input of the deferred block
+        float* pending = nullptr;    // [channel][blockSize], output of the deferred block
+        float* fftRe = nullptr;
+        float* fftIm = nullptr;
+        float* fftTime = nullptr;
+        RealFFT fft;
+
+        // The IR spectra are laid out first, then the delay line they are multiplied with
+        bool Layout(size_t partitions, size_t bins, size_t lanes, size_t tile, int numChannels, size_t blockSize, Scheduling scheduling,
+            RealFFT::Backend backend) {
+            numPartitions = partitions;
+            numBins = bins;
+            numLanes = lanes;
+            tileBins = tile;
+            current = 0;
+            position = 0;
+            numSteps = GetNumSteps(scheduling, partitions, numChannels);
+            step = scheduling == kScheduleDeferred ? numSteps : 0;
+            const size_t deferredSize = scheduling == kScheduleDeferred ? numChannels * 2 * blockSize : 0;
+            const size_t irSize = partitions * bins;
+
+            arena.Begin();
+            const size_t irReIndex = arena.Reserve<float>(irSize);
+            const size_t irImIndex = arena.Reserve<float>(irSize);
+            const size_t delayReIndex = arena.Reserve<float>(irSize * lanes);
+            const size_t delayImIndex = arena.Reserve<float>(irSize * lanes);
+            const size_t sumReIndex = arena.Reserve<float>(bins * lanes);
+            const size_t sumImIndex = arena.Reserve<float>(bins * lanes);
+            const size_t inputIndex = arena.Reserve<float>(numChannels * 2 * blockSize);
+            const size_t outputIndex = arena.Reserve<float>(numChannels * blockSize);
+            const size_t frameIndex = arena.Reserve<float>(deferredSize);
+            const size_t pendingIndex = arena.Reserve<float>(deferredSize / 2);
+            const size_t fftReIndex = arena.Reserve<float>(bins);
+            const size_t fftImIndex = arena.Reserve<float>(bins);
+            const size_t fftTimeIndex = arena.Reserve<float>(2 * blockSize);
+            if (!arena.Commit()) { return false; }
+
+            irRe = arena.Get<float>(irReIndex);
+            irIm = arena.Get<float>(irImIndex);
+            delayRe = arena.Get<float>(delayReIndex);
+            delayIm = arena.Get<float>(delayImIndex);
+            sumRe = arena.Get<float>(sumReIndex);
+            sumIm = arena.Get<float>(sumImIndex);
+            input = arena.Get<float>(inputIndex);
+            output = arena.Get<float>(outputIndex);
+            frame = arena.Get<float>(frameIndex);
+            pending = arena.Get<float>(pendingIndex);
+            fftRe = arena.Get<float>(fftReIndex);
+            fftIm = arena.Get<float>(fftImIndex);
+            fftTime = arena.Get<float>(fftTimeIndex);
+
+            // Only sets up again for a new size or backend
+            fft.SetBackend(backend);
+            return fft.Init(2 * blockSize) == 0;
+        }
+
+        void Reset(int numChannels, size_t blockSize, Scheduling scheduling) {
+            std::fill(delayRe, delayRe + numPartitions * numBins * numLanes, 0.f);
+            std::fill(delayIm, delayIm + numPartitions * numBins * numLanes, 0.f);
+            std::fill(sumRe, sumRe + numBins * numLanes, 0.f);
+            std::fill(sumIm, sumIm + numBins * numLanes, 0.f);
+            std::fill(input, input + numChannels * 2 * blockSize, 0.f);
+            std::fill(output, output + numChannels * blockSize, 0.f);
+            if (scheduling == kScheduleDeferred) {
+                std::fill(pending, pending + numChannels * blockSize, 0.f);
+            }
+            current = 0;
+            position = 0;
+            step = scheduling == kScheduleDeferred ? numSteps : 0;
+        }
+
+        // Every tile but the last holds tileBins bins
+        size_t GetTileSize(size_t tileStart) const {
+            return std::min(tileBins, numBins - tileStart);
+        }
+
+        // Copies one partition's spectrum, numBins values, into its place in every tile
+        void SetPartition(size_t p, const float* re, const float* im) {
+            for (size_t tileStart = 0; tileStart < numBins; tileStart += tileBins) {
+                const size_t size = GetTileSize(tileStart);
+                const size_t offset = tileStart * numPartitions + p * size;
+                std::copy(re + tileStart, re + tileStart + size, irRe + offset);
+                std::copy(im + tileStart, im + tileStart + size, irIm + offset);
+            }
+        }
+    };
+
+    // Spread: the older partitions of the next block. Deferred: a forward
+    // FFT per channel, every partition, an inverse FFT per channel.
+    static size_t GetNumSteps(Scheduling scheduling, size_t numPartitions, int numChannels) {
+        switch (scheduling) {
+        case kScheduleSpread: return numPartitions - 1;
+        case kScheduleDeferred: return numChannels + numPartitions + numChannels;
+        default: return 0;
+        }
+    }
+
+    // One vector holds 4 floats: 4 bins of one channel, 2 bins of 2 channels,
+    // or one bin of 4 channels. Other channel counts are padded to 4 lanes.
+    size_t GetNumLanes() const {
+        if (mNumChannels <= 2) { return mNumChannels; }
+        return (mNumChannels + 3) & ~3;
+    }
+
+    // Evenly sized tiles of at most kTileBytes of sums, one tile when tiling is off
+    size_t GetTileBins(size_t numBins, size_t numLanes) const {
+        if (!mTiled) { return numBins; }
+        const size_t maxBins = std::max((size_t)4, kTileBytes / (2 * sizeof(float) * numLanes));
+        const size_t numTiles = (numBins + maxBins - 1) / maxBins;
+        return ((numBins + numTiles - 1) / numTiles + 3) & ~(size_t)3;
+    }
+
+    template <typename T>
+    int Init(const T* ir, size_t length) {
+        TRACE_SCOPE("MultichannelConvolver::SetIr");
+        if (length == 0 || mNumChannels < 1) { return 1; }
+
+        // Only one build at a time may use the spare
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        State* state = Prepare(GetNumPartitions(length, mBlockSize));
+        if (state == nullptr) { return 1; }
+        for (size_t p = 0; p < state->numPartitions; p++) {
+            Partition(state->fft, state->fftTime, ir, length, mBlockSize, p, state->fftRe, state->fftIm);
+            state->SetPartition(p, state->fftRe, state->fftIm);
+        }
+        Publish();
+        return 0;
+    }
+
+    // Lays out the spare for numPartitions, call with mBuildMutex held
+    State* Prepare(size_t numPartitions) {
+        if (mSpare == nullptr) {
+            mSpare = std::make_unique<State>();
+        }
+        const size_t numBins = GetNumBins(mBlockSize);
+        const size_t numLanes = GetNumLanes();
+        if (!mSpare->Layout(numPartitions, numBins, numLanes, GetTileBins(numBins, numLanes), mNumChannels, mBlockSize, mScheduling,
+            mFFTBackend)) {
+            return nullptr;
+        }
+        return mSpare.get();
+    }
+
+    // The replaced state is kept as the next spare
+    void Publish() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mState.swap(mSpare);
+    }
+
+    // Spectrum of partition p into re and im (GetNumBins() values each), zero
+    // padded to the FFT size, padding bins are zeroed
+    template <typename T>
+    static void Partition(RealFFT& fft, float* time, const T* ir, size_t length, size_t blockSize, size_t p, float* re, float* im) {
+        const size_t fftSize = 2 * blockSize;
+        const size_t numBins = GetNumBins(blockSize);
+        const size_t offset = p * blockSize;
+        const size_t count = std::min(blockSize, length - offset);
+        std::fill(time, time + fftSize, 0.f);
+        for (size_t i = 0; i < count; i++) {
+            time[i] = static_cast<float>(ir[offset + i]);
+        }
+        fft.Forward(time, re, im);
+        std::fill(re + blockSize + 1, re + numBins, 0.f);
+        std::fill(im + blockSize + 1, im + numBins, 0.f);
+    }
+
+    // Called once a block is buffered. The previous block's paced steps are finished first.
+    void ProcessBlock(State& state) {
+        const size_t fftSize = 2 * mBlockSize;
+        RunSteps(state, state.numSteps);
+
+        if (mScheduling == kScheduleDeferred) {
+            // The finished block plays next, this one is transformed while the next is buffered
+            std::swap(state.output, state.pending);
+            for (int c = 0; c < mNumChannels; c++) {
+                float* in = state.input + c * fftSize;
+                std::copy(in, in + fftSize, state.frame + c * fftSize);
+                std::copy(in + mBlockSize, in + fftSize, in);
+            }
+            state.step = 0;
+            return;
+        }
+
+        for (int c = 0; c < mNumChannels; c++) {
+            float* in = state.input + c * fftSize;
+            Transform(state, c, in);
+            std::copy(in + mBlockSize, in + fftSize, in);
+        }
+        if (mScheduling == kScheduleAtBlock) {
+            MultiplyPartitions(state, 1, state.numPartitions);
+        }
+        // The newest partition goes last, so every scheduling sums in the same order
+        MultiplyPartitions(state, 0, 1);
+        state.current = (state.current + state.numPartitions - 1) % state.numPartitions;
+        for (int c = 0; c < mNumChannels; c++) {
+            InverseTransform(state, c, state.output + c * mBlockSize);
+        }
+        state.step = 0;
+    }
+
+    // Runs the pending block's steps up to target, consecutive partitions in one pass over the tiles
+    void RunSteps(State& state, size_t target) {
+        if (mScheduling == kScheduleSpread) {
+            if (state.step < target) {
+                MultiplyPartitions(state, state.step + 1, target + 1);
+                state.step = target;
+            }
+            return;
+        }
+        const size_t fftSize = 2 * mBlockSize;
+        const size_t numChannels = (size_t)mNumChannels;
+        const size_t macEnd = numChannels + state.numPartitions;
+        while (state.step < target) {
+            if (state.step < numChannels) {
+                Transform(state, (int)state.step, state.frame + state.step * fftSize);
+                state.step++;
+            }
+            else if (state.step < macEnd) {
+                // Same order as ProcessBlock(), the newest partition last
+                const size_t end = std::min(target, macEnd);
+                const size_t first = state.step - numChannels + 1;
+                MultiplyPartitions(state, first, std::min(end - numChannels + 1, state.numPartitions));
+                if (end == macEnd) {
+                    MultiplyPartitions(state, 0, 1);
+                    state.current = (state.current + state.numPartitions - 1) % state.numPartitions;
+                }
+                state.step = end;
+            }
+            else {
+                const size_t c = state.step - macEnd;
+                InverseTransform(state, (int)c, state.pending + c * mBlockSize);
+                state.step++;
+            }
+        }
+    }
+
+    // Newest input spectrum of channel c into its slot of every tile, channels interleaved per bin
+    void Transform(State& state, int c, const float* in) {
+        const size_t complexSize = mBlockSize + 1;
+        const size_t lanes = state.numLanes;
+        state.fft.Forward(in, state.fftRe, state.fftIm);
+        for (size_t tileStart = 0; tileStart < complexSize; tileStart += state.tileBins) {
+            const size_t size = state.GetTileSize(tileStart);
+            const size_t offset = (tileStart * state.numPartitions + state.current * size) * lanes + c;
+            float* newRe = state.delayRe + offset;
+            float* newIm = state.delayIm + offset;
+            for (size_t k = 0; k < std::min(size, complexSize - tileStart); k++) {
+                newRe[k * lanes] = state.fftRe[tileStart + k];
+                newIm[k * lanes] = state.fftIm[tileStart + k];
+            }
+        }
+    }
+
+    // Partitions first to last - 1 of the IR, each times the input spectrum
+    // that many blocks older than the newest, one tile at a time
+    static void MultiplyPartitions(State& state, size_t first, size_t last) {
+        const size_t lanes = state.numLanes;
+        for (size_t tileStart = 0; tileStart < state.numBins; tileStart += state.tileBins) {
+            const size_t size = state.GetTileSize(tileStart);
+            const size_t tileOffset = tileStart * state.numPartitions;
+            float* sumRe = state.sumRe + tileStart * lanes;
+            float* sumIm = state.sumIm + tileStart * lanes;
+            for (size_t p = first; p < last; p++) {
+                const size_t slot = (state.current + p) % state.numPartitions;
+                const size_t x = (tileOffset + slot * size) * lanes;
+                const size_t h = tileOffset + p * size;
+                MultiplyAdd(sumRe, sumIm, state.delayRe + x, state.delayIm + x, state.irRe + h, state.irIm + h, size, lanes);
+            }
+        }
+    }
+
+    // Overlap-save: only the second half of each inverse transform is valid.
+    // The last channel clears the sums for the next block.
+    void InverseTransform(State& state, int c, float* out) {
+        const size_t complexSize = mBlockSize + 1;
+        const size_t lanes = state.numLanes;
+        for (size_t k = 0; k < complexSize; k++) {
+            state.fftRe[k] = state.sumRe[k * lanes + c];
+            state.fftIm[k] = state.sumIm[k * lanes + c];
+        }
+        state.fft.Inverse(state.fftTime, state.fftRe, state.fftIm);
+        std::copy(state.fftTime + mBlockSize, state.fftTime + 2 * mBlockSize, out);
+        if (c == mNumChannels - 1) {
+            std::fill(state.sumRe, state.sumRe + state.numBins * lanes, 0.f);
+            std::fill(state.sumIm, state.sumIm + state.numBins * lanes, 0.f);
+        }
+    }
+
+    // sum += x * h for numBins bins of every lane, h is shared by all lanes of a bin
+    static void MultiplyAdd(float* sumRe, float* sumIm, const float* xRe, const float* xIm, const float* hRe, const float* hIm,
+        size_t numBins, size_t lanes) {
+#if defined(TARGET_INTEL)
+        if (lanes == 1) {
+            for (size_t k = 0; k < numBins; k += 4) {
+                MultiplyAdd(sumRe + k, sumIm + k, xRe + k, xIm + k, F32_VEC_ULOAD(hRe + k), F32_VEC_ULOAD(hIm + k));
+            }
+        }
+        else if (lanes == 2) {
+            // One load of 4 bins feeds two vectors of 2 bins x 2 channels
+            for (size_t k = 0; k < numBins; k += 4) {
+                const vFloat re = F32_VEC_ULOAD(hRe + k);
+                const vFloat im = F32_VEC_ULOAD(hIm + k);
+                const size_t i = 2 * k;
+                MultiplyAdd(sumRe + i, sumIm + i, xRe + i, xIm + i, F32_VEC_SHUFFLE(re, re, 0x50), F32_VEC_SHUFFLE(im, im, 0x50));
+                MultiplyAdd(sumRe + i + 4, sumIm + i + 4, xRe + i + 4, xIm + i + 4, F32_VEC_SHUFFLE(re, re, 0xFA), F32_VEC_SHUFFLE(im, im, 0xFA));
+            }
+        }
+        else {
+            for (size_t k = 0; k < numBins; k++) {
+                const vFloat re = float2vector(hRe[k]);
+                const vFloat im = float2vector(hIm[k]);
+                for (size_t c = 0; c < lanes; c += 4) {
+                    const size_t i = k * lanes + c;
+                    MultiplyAdd(sumRe + i, sumIm + i, xRe + i, xIm + i, re, im);
+                }
+            }
+        }
+#else
+        for (size_t k = 0; k < numBins; k++) {
+            for (size_t c = 0; c < lanes; c++) {
+                const size_t i = k * lanes + c;
+                sumRe[i] += xRe[i] * hRe[k] - xIm[i] * hIm[k];
+                sumIm[i] += xRe[i] * hIm[k] + xIm[i] * hRe[k];
+            }
+        }
+#endif
+    }
+
+#if defined(TARGET_INTEL)
+    static void MultiplyAdd(float* sumRe, float* sumIm, const float* xRe, const float* xIm, vFloat hRe, vFloat hIm) {
+        const vFloat re = F32_VEC_ULOAD(xRe);
+        const vFloat im = F32_VEC_ULOAD(xIm);
+        F32_VEC_USTORE(sumRe, F32_VEC_ADD_OP(F32_VEC_ULOAD(sumRe), F32_VEC_SUB_OP(F32_VEC_MUL_OP(re, hRe), F32_VEC_MUL_OP(im, hIm))));
+        F32_VEC_USTORE(sumIm, F32_VEC_ADD_OP(F32_VEC_ULOAD(sumIm), F32_VEC_ADD_OP(F32_VEC_MUL_OP(re, hIm), F32_VEC_MUL_OP(im, hRe))));
+    }
+#endif
+
+    int mNumChannels;
+    size_t mBlockSize;
+    Scheduling mScheduling;
+    bool mTiled = true;
+    RealFFT::Backend mFFTBackend = RealFFT::kDefaultBackend;
+    std::mutex mMutex;
+    mutable std::mutex mBuildMutex;
+    std::unique_ptr<State> mState;
+    std::unique_ptr<State> mSpare;
+};
+
+END_IPLUG_NAMESPACE
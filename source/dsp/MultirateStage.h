@@ -0,0 +1,270 @@
+#pragma once
+
+#include "IPlugConstants.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Runs a convolver at 1/D of the host rate. The input is low-passed and
+// decimated, convolved at the reduced rate (the IR is resampled to that
+// rate, close to its native one), then interpolated back with the same
+// filter. The band above the reduced Nyquist is split off as the exact
+// complement of the low path and passed at the IR's level at the band
+// edge, or dropped when the IR has nothing there. That is one scalar gain:
+// whatever shape the IR has above the reduced Nyquist (a rolloff, a
+// resonance) is flattened to its mean level there. The high band is delayed
+// by D x the convolver's latency as well, set with SetConvolverLatency(), so
+// it stays lined up with the convolved low band.
+// Added latency is GetLatency() host samples plus D x the convolver's own.
+// A stereo convolver takes both channels' stages at once, see ProcessPair().
+class MultirateStage {
+public:
+    // Host rates from this one up run at half (or quarter) rate
+    static constexpr double kMinHostRate = 88200.;
+
+    static int GetDecimation(double hostRate) {
+        if (hostRate >= 2. * kMinHostRate) { return 4; }
+        if (hostRate >= kMinHostRate) { return 2; }
+        return 1;
+    }
+
+    // Allocates, call outside the audio thread (OnReset)
+    void OnReset(int decimation) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDecimation = std::max(decimation, 1);
+        mNumTaps = kTapsPerPhase * mDecimation + 1;
+        mFilter = MakeLowpass(mNumTaps, 0.5 / mDecimation);
+
+        mInput.clear();
+        mDecimated.clear();
+        mConvolved.clear();
+        AllocateRings();
+        mConvolverIn.assign(kMaxChunk / mDecimation + 1, 0.f);
+        mConvolverOut.assign(kMaxChunk / mDecimation + 1, 0.f);
+        mCount = 0;
+    }
+
+    // Latency of the convolver passed to process(), in reduced rate samples.
+    // Allocates when the high band delay outgrows the rings, call outside the
+    // audio thread. process() passes the input through while that happens.
+    void SetConvolverLatency(int latency) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mConvolverLatency = std::max(latency, 0);
+        AllocateRings();
+    }
+
+    int GetDecimation() const {
+        return mDecimation;
+    }
+
+    // Group delay of the decimation and interpolation filters together
+    int GetLatency() const {
+        return mNumTaps - 1;
+    }
+
+    // Safe from any thread, the IR worker sets it with every IR
+    void SetHighBandGain(float gain) {
+        mHighBandGain.store(gain, std::memory_order_relaxed);
+    }
+
+    // Mean magnitude of the IR between 0.75 and 0.95 of its Nyquist, below -60 dB counts as nothing
+    static float EstimateHighBandGain(const float* ir, size_t length) {
+        double sum = 0.;
+        const int numPoints = 8;
+        for (int i = 0; i < numPoints; i++) {
+            const double omega = M_PI * (0.75 + 0.2 * i / (numPoints - 1));
+            std::complex<double> response = 0.;
+            for (size_t n = 0; n < length; n++) {
+                response += (double)ir[n] * std::polar(1., -omega * n);
+            }
+            sum += std::abs(response);
+        }
+        const double gain = sum / numPoints;
+        return gain < 1e-3 ? 0.f : (float)gain;
+    }
+
+    template <typename Convolver>
+    void process(Convolver& convolver, iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("MultirateStage::process");
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (!lock.owns_lock()) {
+            for (int s = 0; s < nFrames; s++) {
+                outputs[0][s] = inputs[0][s];
+            }
+            return;
+        }
+        for (int done = 0; done < nFrames; done += kMaxChunk) {
+            const int n = std::min(nFrames - done, kMaxChunk);
+            const int numDecimated = Decimate(inputs[0] + done, n);
+            if (numDecimated > 0) {
+                iplug::sample* convolverIn = mConvolverIn.data();
+                iplug::sample* convolverOut = mConvolverOut.data();
+                convolver.process(&convolverIn, &convolverOut, numDecimated);
+            }
+            Reconstruct(outputs[0] + done, n, numDecimated);
+        }
+    }
+
+    // Both channels through one convolver that takes two channels per call.
+    // The stages were reset together, so they decimate the same samples.
+    template <typename Convolver>
+    static void ProcessPair(MultirateStage (&stages)[2], Convolver& convolver, iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("MultirateStage::process");
+        std::unique_lock<std::mutex> lock0(stages[0].mMutex, std::try_to_lock);
+        std::unique_lock<std::mutex> lock1(stages[1].mMutex, std::try_to_lock);
+        if (!lock0.owns_lock() || !lock1.owns_lock()) {
+            for (int c = 0; c < 2; c++) {
+                std::copy(inputs[c], inputs[c] + nFrames, outputs[c]);
+            }
+            return;
+        }
+        for (int done = 0; done < nFrames; done += kMaxChunk) {
+            const int n = std::min(nFrames - done, kMaxChunk);
+            const int numDecimated = stages[0].Decimate(inputs[0] + done, n);
+            stages[1].Decimate(inputs[1] + done, n);
+            if (numDecimated > 0) {
+                iplug::sample* convolverIn[2] = { stages[0].mConvolverIn.data(), stages[1].mConvolverIn.data() };
+                iplug::sample* convolverOut[2] = { stages[0].mConvolverOut.data(), stages[1].mConvolverOut.data() };
+                convolver.process(convolverIn, convolverOut, numDecimated);
+            }
+            for (int c = 0; c < 2; c++) {
+                stages[c].Reconstruct(outputs[c] + done, n, numDecimated);
+            }
+        }
+    }
+
+private:
+    static constexpr int kTapsPerPhase = 36;
+    static constexpr int kMaxChunk = 512;
+
+    static size_t NextPowerOfTwo(size_t size) {
+        size_t power = 1;
+        while (power < size) {
+            power *= 2;
+        }
+        return power;
+    }
+
+    // The host rate ring holds a chunk plus the high band delay, the reduced
+    // rate rings a chunk plus the filter and the convolver latency. Grown
+    // rings start silent, equally sized ones keep their history.
+    void AllocateRings() {
+        const size_t inputSize = NextPowerOfTwo(kMaxChunk + GetHighBandDelay() + 1);
+        const size_t reducedSize = NextPowerOfTwo((kMaxChunk + mNumTaps) / mDecimation + mConvolverLatency + 2);
+        if (mInput.size() != inputSize) {
+            mInput.assign(inputSize, 0.f);
+        }
+        if (mDecimated.size() != reducedSize) {
+            mDecimated.assign(reducedSize, 0.f);
+            mConvolved.assign(reducedSize, 0.f);
+        }
+        mInputMask = inputSize - 1;
+        mReducedMask = reducedSize - 1;
+    }
+
+    // Where the convolved low band comes out: the filters' group delay plus the convolver's latency
+    uint64_t GetHighBandDelay() const {
+        return (uint64_t)(mNumTaps - 1) + (uint64_t)mDecimation * mConvolverLatency;
+    }
+
+    // Windowed sinc (Blackman-Harris), unity gain at DC
+    static std::vector<float> MakeLowpass(int numTaps, double cutoff) {
+        std::vector<double> taps(numTaps);
+        double sum = 0.;
+        const double centre = 0.5 * (numTaps - 1);
+        for (int i = 0; i < numTaps; i++) {
+            const double x = i - centre;
+            const double sinc = x == 0. ? 2. * cutoff : sin(2. * M_PI * cutoff * x) / (M_PI * x);
+            const double phase = 2. * M_PI * i / (numTaps - 1);
+            const double window = 0.35875 - 0.48829 * cos(phase) + 0.14128 * cos(2. * phase) - 0.01168 * cos(3. * phase);
+            taps[i] = sinc * window;
+            sum += taps[i];
+        }
+        std::vector<float> filter(numTaps);
+        for (int i = 0; i < numTaps; i++) {
+            filter[i] = (float)(taps[i] / sum);
+        }
+        return filter;
+    }
+
+    // Upsampled signals hold a sample at every host index n with n % D == D - 1
+    // and reduced rate sample m sits at host index m * D + D - 1
+    float Interpolate(const std::vector<float>& ring, int64_t n) const {
+        if (n < 0) { return 0.f; }
+        const int firstTap = (int)((n + 1) % mDecimation);
+        const int64_t newest = n - firstTap - (mDecimation - 1);
+        if (newest < 0) { return 0.f; }
+        float sum = 0.f;
+        int64_t m = newest / mDecimation;
+        for (int k = firstTap; k < mNumTaps && m >= 0; k += mDecimation, m--) {
+            sum += mFilter[k] * ring[m & mReducedMask];
+        }
+        return sum * mDecimation;
+    }
+
+    // Low-passes a chunk into mConvolverIn, only where a sample is kept.
+    // Returns the number of reduced rate samples.
+    int Decimate(const iplug::sample* in, int nFrames) {
+        int numDecimated = 0;
+        for (int i = 0; i < nFrames; i++) {
+            const uint64_t n = mCount + i;
+            mInput[n & mInputMask] = (float)in[i];
+            if (n % mDecimation != (uint64_t)(mDecimation - 1)) { continue; }
+
+            float sum = 0.f;
+            for (int k = 0; k < mNumTaps && (uint64_t)k <= n; k++) {
+                sum += mFilter[k] * mInput[(n - k) & mInputMask];
+            }
+            mDecimated[(n / mDecimation) & mReducedMask] = sum;
+            mConvolverIn[numDecimated++] = sum;
+        }
+        return numDecimated;
+    }
+
+    // Interpolates the chunk's mConvolverOut back to out, adding the high
+    // band as input minus its own low path, both as late as the convolved low band
+    void Reconstruct(iplug::sample* out, int nFrames, int numDecimated) {
+        const uint64_t first = mCount / mDecimation;
+        for (int i = 0; i < numDecimated; i++) {
+            mConvolved[(first + i) & mReducedMask] = (float)mConvolverOut[i];
+        }
+
+        const uint64_t delay = GetHighBandDelay();
+        const int64_t lowPathDelay = (int64_t)mDecimation * mConvolverLatency;
+        const float highBandGain = mHighBandGain.load(std::memory_order_relaxed);
+        for (int i = 0; i < nFrames; i++) {
+            const uint64_t n = mCount + i;
+            float sample = Interpolate(mConvolved, (int64_t)n);
+            if (highBandGain > 0.f) {
+                const float delayed = n >= delay ? mInput[(n - delay) & mInputMask] : 0.f;
+                sample += highBandGain * (delayed - Interpolate(mDecimated, (int64_t)n - lowPathDelay));
+            }
+            out[i] = (iplug::sample)sample;
+        }
+        mCount += nFrames;
+    }
+
+    int mDecimation = 1;
+    int mNumTaps = 1;
+    int mConvolverLatency = 0;
+    std::atomic<float> mHighBandGain{ 0.f };
+    std::vector<float> mFilter;
+    std::vector<float> mInput;        // host rate ring
+    std::vector<float> mDecimated;    // reduced rate rings
+    std::vector<float> mConvolved;
+    std::vector<iplug::sample> mConvolverIn;
+    std::vector<iplug::sample> mConvolverOut;
+    size_t mInputMask = 0;
+    size_t mReducedMask = 0;
+    uint64_t mCount = 0;              // host samples so far
+    std::mutex mMutex;                // the audio thread only try-locks it
+};
+
+END_IPLUG_NAMESPACE
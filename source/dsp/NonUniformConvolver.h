@@ -0,0 +1,266 @@
+#pragma once
+
+#include "MultichannelConvolver.h"
+#include "DirectConvolver.h"
+#include "IPlugConstants.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Non-uniformly partitioned convolution from MultichannelConvolver stages
+// of growing block sizes, like HISSTools ({64, 256, 1024, 4096}) or
+// TwoStageFFTConvolver ({128, 1024}) lay out an IR. Stage i starts where
+// its extra latency over the first stage lines it up, so no delay lines
+// are needed, and the overall latency is the first block size.
+// With spread load the first stage paces its older partitions over the
+// host blocks and the later stages run deferred (twice their block size of
+// latency), so even a 4096 stage's FFTs are split across the 64 sample
+// host blocks that buffer it instead of landing on one of them.
+// With a direct head the first block size of the IR runs through a
+// DirectConvolver per channel and the stages take the rest, so there is
+// no latency at all. AutoConvolver runs this layout for stereo pairs.
+class NonUniformConvolver {
+public:
+    NonUniformConvolver(int numChannels, const std::vector<size_t>& blockSizes, bool spreadLoad = true, bool directHead = false) :
+        mNumChannels(numChannels),
+        mBlockSizes(blockSizes),
+        mSpreadLoad(spreadLoad),
+        mDirectHead(directHead),
+        mIn(std::max(numChannels, 0)),
+        mOut(std::max(numChannels, 0)),
+        mTemp(std::max(numChannels, 0)),
+        mTempBuffer(std::max(numChannels, 0) * kMaxChunk),
+        mSumBuffer(std::max(numChannels, 0) * kMaxChunk)
+    {}
+    ~NonUniformConvolver() {}
+
+    // Block sizes from first to last, each kGrowth times the one before
+    static std::vector<size_t> MakeBlockSizes(size_t first, size_t last) {
+        std::vector<size_t> blockSizes;
+        for (size_t size = first; size <= last; size *= kGrowth) {
+            blockSizes.push_back(size);
+        }
+        return blockSizes;
+    }
+
+    void OnReset() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mState != nullptr) {
+            for (int i = 0; i < mState->numActive; i++) {
+                mState->stages[i]->OnReset();
+            }
+            for (std::unique_ptr<DirectConvolver>& head : mState->heads) {
+                head->OnReset();
+            }
+        }
+    }
+
+    // Takes effect on the next SetIr()
+    void SetBlockSizes(const std::vector<size_t>& blockSizes) {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        mBlockSizes = blockSizes;
+    }
+
+    // Fails unless the block sizes are powers of two in increasing order,
+    // with a direct head the first one must fit a DirectConvolver
+    int SetIr(const float* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    int SetIr(const double* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    // Of the current IR's layout
+    int GetLatency() const {
+        return mLatency.load();
+    }
+
+    int GetNumChannels() const {
+        return mNumChannels;
+    }
+
+    // Frees every stage and head, process() passes the input through until the next SetIr()
+    void Clear() {
+        std::unique_ptr<StageSet> state;
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mState.swap(state);
+        }
+        mSpare.reset();
+    }
+
+    size_t GetMemoryUsage() const {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        return GetMemoryUsage(mState.get()) + GetMemoryUsage(mSpare.get());
+    }
+
+    // inputs and outputs hold GetNumChannels() channels, they may be the same buffers
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("NonUniformConvolver::process");
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (!lock.owns_lock() || mState == nullptr) {
+            for (int c = 0; c < mNumChannels; c++) {
+                if (outputs[c] != inputs[c]) {
+                    std::copy(inputs[c], inputs[c] + nFrames, outputs[c]);
+                }
+            }
+            return;
+        }
+
+        // The later stages go first, so the first stage can write in place
+        StageSet& state = *mState;
+        int done = 0;
+        while (done < nFrames) {
+            const int n = std::min(nFrames - done, kMaxChunk);
+            for (int c = 0; c < mNumChannels; c++) {
+                mIn[c] = inputs[c] + done;
+                mOut[c] = outputs[c] + done;
+                mTemp[c] = mTempBuffer.data() + c * kMaxChunk;
+                std::fill(mSumBuffer.data() + c * kMaxChunk, mSumBuffer.data() + c * kMaxChunk + n, (iplug::sample)0.);
+            }
+            for (int i = 1; i < state.numActive; i++) {
+                state.stages[i]->process(mIn.data(), mTemp.data(), n);
+                AddTemp(n);
+            }
+            for (int c = 0; c < (int)state.heads.size(); c++) {
+                state.heads[c]->process(&mIn[c], &mTemp[c], n);
+            }
+            if (!state.heads.empty()) {
+                AddTemp(n);
+            }
+            if (state.numActive > 0) {
+                state.stages[0]->process(mIn.data(), mOut.data(), n);
+            }
+            else {
+                for (int c = 0; c < mNumChannels; c++) {
+                    std::fill(mOut[c], mOut[c] + n, (iplug::sample)0.);
+                }
+            }
+            for (int c = 0; c < mNumChannels; c++) {
+                const iplug::sample* sum = mSumBuffer.data() + c * kMaxChunk;
+                for (int s = 0; s < n; s++) {
+                    mOut[c][s] += sum[s];
+                }
+            }
+            done += n;
+        }
+    }
+
+private:
+    static constexpr int kMaxChunk = 256;
+    static constexpr size_t kGrowth = 4;
+
+    // One engine per block size, stages past the end of the IR are left empty.
+    // With a direct head the stages start after it, and only the heads may be active.
+    struct StageSet {
+        std::vector<size_t> blockSizes;
+        std::vector<std::unique_ptr<MultichannelConvolver>> stages;
+        std::vector<std::unique_ptr<DirectConvolver>> heads;
+        int numActive = 0;
+    };
+
+    void AddTemp(int n) {
+        for (int c = 0; c < mNumChannels; c++) {
+            iplug::sample* sum = mSumBuffer.data() + c * kMaxChunk;
+            for (int s = 0; s < n; s++) {
+                sum[s] += mTemp[c][s];
+            }
+        }
+    }
+
+    bool IsValidLayout() const {
+        if (mBlockSizes.empty() || mNumChannels < 1) { return false; }
+        if (mDirectHead && mBlockSizes[0] > DirectConvolver::kMaxLength) { return false; }
+        for (size_t i = 0; i < mBlockSizes.size(); i++) {
+            const size_t size = mBlockSizes[i];
+            if (size == 0 || (size & (size - 1)) != 0) { return false; }
+            if (i > 0 && size <= mBlockSizes[i - 1]) { return false; }
+        }
+        return true;
+    }
+
+    // Stage i convolves the IR from its latency minus the first stage's latency
+    size_t GetStageOffset(const StageSet& set, size_t i) const {
+        return (size_t)(set.stages[i]->GetLatency() - set.stages[0]->GetLatency());
+    }
+
+    template <typename T>
+    int Init(const T* ir, size_t length) {
+        TRACE_SCOPE("NonUniformConvolver::SetIr");
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        if (length == 0 || !IsValidLayout()) { return 1; }
+        // A spare of another layout is built again
+        if (mSpare == nullptr || mSpare->blockSizes != mBlockSizes) {
+            mSpare = std::make_unique<StageSet>();
+            mSpare->blockSizes = mBlockSizes;
+            for (size_t i = 0; i < mBlockSizes.size(); i++) {
+                const MultichannelConvolver::Scheduling scheduling = !mSpreadLoad ? MultichannelConvolver::kScheduleAtBlock :
+                    i == 0 ? MultichannelConvolver::kScheduleSpread : MultichannelConvolver::kScheduleDeferred;
+                mSpare->stages.push_back(std::make_unique<MultichannelConvolver>(mNumChannels, mBlockSizes[i], scheduling));
+            }
+            for (int c = 0; mDirectHead && c < mNumChannels; c++) {
+                mSpare->heads.push_back(std::make_unique<DirectConvolver>());
+            }
+        }
+
+        StageSet& set = *mSpare;
+        const size_t headLength = set.heads.empty() ? 0 : std::min(length, mBlockSizes[0]);
+        for (std::unique_ptr<DirectConvolver>& head : set.heads) {
+            if (head->SetIr(ir, headLength) != 0) { return 1; }
+        }
+        // The stages' latency lines the rest up behind the head
+        ir += headLength;
+        length -= headLength;
+        set.numActive = 0;
+        for (size_t i = 0; i < set.stages.size(); i++) {
+            const size_t begin = GetStageOffset(set, i);
+            if (begin >= length) { break; }
+            const size_t end = i + 1 < set.stages.size() ? std::min(length, GetStageOffset(set, i + 1)) : length;
+            if (set.stages[i]->SetIr(ir + begin, end - begin) != 0) { return 1; }
+            set.numActive++;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mState.swap(mSpare);
+            mLatency.store(mDirectHead ? 0 : (int)mBlockSizes[0]);
+        }
+        return 0;
+    }
+
+    static size_t GetMemoryUsage(const StageSet* set) {
+        if (set == nullptr) { return 0; }
+        size_t bytes = 0;
+        for (const std::unique_ptr<MultichannelConvolver>& stage : set->stages) {
+            bytes += stage->GetMemoryUsage();
+        }
+        for (const std::unique_ptr<DirectConvolver>& head : set->heads) {
+            bytes += head->GetMemoryUsage();
+        }
+        return bytes;
+    }
+
+    int mNumChannels;
+    std::vector<size_t> mBlockSizes;
+    bool mSpreadLoad;
+    bool mDirectHead;
+    std::atomic<int> mLatency{ 0 };
+    std::mutex mMutex;
+    mutable std::mutex mBuildMutex;
+    std::unique_ptr<StageSet> mState;
+    std::unique_ptr<StageSet> mSpare;
+    std::vector<iplug::sample*> mIn;
+    std::vector<iplug::sample*> mOut;
+    std::vector<iplug::sample*> mTemp;
+    std::vector<iplug::sample> mTempBuffer;
+    std::vector<iplug::sample> mSumBuffer;
+};
+
+END_IPLUG_NAMESPACE
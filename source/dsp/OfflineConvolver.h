@@ -0,0 +1,113 @@
+#pragma once
+
+#include "convoengine.h"
+#include "IPlugConstants.h"
+#include "Trace.h"
+#include <memory>
+#include <mutex>
+
+BEGIN_IPLUG_NAMESPACE
+
+static_assert(sizeof(iplug::sample) == sizeof(WDL_FFT_REAL), "OfflineConvolver needs iplug::sample and WDL_FFT_REAL to match");
+
+// Throughput-first convolver for offline renders: WDL_ConvolutionEngine with
+// large uniform partitions, so the whole IR costs a few big FFTs per
+// kFftSize / 2 samples instead of many small ones per host block.
+// Latency is kFftSize / 2, report it while this convolver is in use.
+// Only run it while the host renders offline. process() only tries the lock
+// and passes the input through while SetIr() swaps the engine.
+// The replaced engine is kept as a spare and rebuilt in place by the next
+// SetIr(), so rendering several takes doesn't reallocate its partitions.
+class OfflineConvolver {
+public:
+    OfflineConvolver() {}
+    ~OfflineConvolver() {}
+
+    void OnReset() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mEngine != nullptr) {
+            mEngine->Reset();
+        }
+    }
+
+    int SetIr(const WDL_FFT_REAL* ir, size_t length, double sampleRate) {
+        TRACE_SCOPE("OfflineConvolver::SetIr");
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        mImpulse.SetNumChannels(1);
+        if (length > mImpulse.SetLength(length)) {
+            return 1;
+        }
+        mImpulse.samplerate = sampleRate;
+        memcpy(mImpulse.impulses[0].Get(), ir, length * sizeof(WDL_FFT_REAL));
+
+        if (mSpare == nullptr) {
+            mSpare = std::make_unique<WDL_ConvolutionEngine>();
+        }
+        mSpare->SetImpulse(&mImpulse, kFftSize);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mEngine.swap(mSpare);
+        mLatency = mEngine->GetLatency();
+        return 0;
+    }
+
+    // Frees the engines once realtime playback is back
+    void Clear() {
+        std::unique_ptr<WDL_ConvolutionEngine> engine;
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mEngine.swap(engine);
+        }
+        mSpare.reset();
+        mImpulse.SetLength(0);
+    }
+
+    bool IsReady() {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mEngine != nullptr;
+    }
+
+    int GetLatency() {
+        return mLatency;
+    }
+
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("OfflineConvolver::process");
+        iplug::sample* inPtr = inputs[0];
+        iplug::sample* outPtr = outputs[0];
+
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (!lock.owns_lock() || mEngine == nullptr) {
+            for (int s = 0; s < nFrames; s++) {
+                outPtr[s] = inPtr[s];
+            }
+            return;
+        }
+
+        WDL_FFT_REAL* in = reinterpret_cast<WDL_FFT_REAL*>(inPtr);
+        mEngine->Add(&in, nFrames, 1);
+        int nAvailableSamples = wdl_min(mEngine->Avail(nFrames), nFrames);
+
+        const int unprocessed = nFrames - nAvailableSamples;
+        if (unprocessed > 0) {
+            memset(outPtr, 0, unprocessed * sizeof(iplug::sample));
+        }
+        if (nAvailableSamples > 0) {
+            memcpy(&outPtr[unprocessed], mEngine->Get()[0], nAvailableSamples * sizeof(iplug::sample));
+            mEngine->Advance(nAvailableSamples);
+        }
+    }
+
+private:
+    static constexpr int kFftSize = 32768;
+
+    std::mutex mMutex;
+    std::mutex mBuildMutex;
+    std::unique_ptr<WDL_ConvolutionEngine> mEngine;
+    std::unique_ptr<WDL_ConvolutionEngine> mSpare;
+    WDL_ImpulseBuffer mImpulse;
+    int mLatency = kFftSize / 2;
+};
+
+END_IPLUG_NAMESPACE
@@ -0,0 +1,587 @@
+#pragma once
+
+#include "AudioFFT.h"
+#include "convoengine.h"   // WDL's fft.h, by way of convoengine.h so r8brain's fft.h can't shadow it
+#include "HISSTools_FFT/HISSTools_FFT.h"
+#include "AlignedBuffer.h"
+#include "AH_VectorOps.h"
+#include "IPlugConstants.h"
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+BEGIN_IPLUG_NAMESPACE
+
+// Real FFT with a selectable implementation, used by MultichannelConvolver
+// and the NonUniformConvolver built from it. The HISSTools, TwoStage, WDL
+// and offline engines keep the FFT of their library. Every backend takes
+// size samples and gives size / 2 + 1 bins split into real and imaginary
+// parts in natural order, unscaled, and the inverse scales by 1 / size
+// (AudioFFT's convention), so spectra of one backend can be used with
+// another. RegressionSuite checks each against the reference backend.
+// Sizes are powers of two from 16 on, WDL also stops at 65536.
+// Not thread safe, one per thread like AudioFFT.
+class RealFFT {
+public:
+    enum Backend {
+        kBackendAudioFFT = 0,  // FFTConvolver's AudioFFT (Ooura, or the platform FFT it was built with)
+        kBackendWdl,           // WDL_real_fft
+        kBackendHISSTools,     // HISSTools_FFT
+        kBackendStockham,      // ours: SIMD radix-4 Stockham, no bit reversal pass
+        kBackendReference,     // plain radix-2 in double precision, slow
+        kNumBackends
+    };
+    static constexpr Backend kDefaultBackend = kBackendAudioFFT;
+
+    explicit RealFFT(Backend backend = kDefaultBackend) :
+        mBackend(backend)
+    {}
+
+    RealFFT(const RealFFT&) = delete;
+    RealFFT& operator=(const RealFFT&) = delete;
+
+    static const char* GetBackendName(Backend backend) {
+        switch (backend) {
+        case kBackendAudioFFT: return "audiofft";
+        case kBackendWdl: return "wdl";
+        case kBackendHISSTools: return "hisstools";
+        case kBackendStockham: return "stockham";
+        case kBackendReference: return "reference";
+        default: return "unknown";
+        }
+    }
+
+    // Takes effect on the next Init()
+    void SetBackend(Backend backend) {
+        mBackend = backend;
+    }
+
+    Backend GetBackend() const {
+        return mBackend;
+    }
+
+    size_t GetSize() const {
+        return mImpl != nullptr ? mImpl->size : 0;
+    }
+
+    // Returns 0 on success. Allocates, call outside the audio thread.
+    int Init(size_t size) {
+        if (mImpl != nullptr && mImpl->size == size && mImplBackend == mBackend) { return 0; }
+        mImpl.reset();
+        if (size < 16 || (size & (size - 1)) != 0) { return 1; }
+        std::unique_ptr<Impl> impl;
+        switch (mBackend) {
+        case kBackendAudioFFT: impl = std::make_unique<AudioFFTImpl>(); break;
+        case kBackendWdl: impl = std::make_unique<WdlImpl>(); break;
+        case kBackendHISSTools: impl = std::make_unique<HISSToolsImpl>(); break;
+        case kBackendStockham: impl = std::make_unique<StockhamImpl>(); break;
+        case kBackendReference: impl = std::make_unique<ReferenceImpl>(); break;
+        default: return 1;
+        }
+        impl->size = size;
+        if (!impl->Init(size)) { return 1; }
+        mImpl = std::move(impl);
+        mImplBackend = mBackend;
+        return 0;
+    }
+
+    // size samples to size / 2 + 1 bins
+    void Forward(const float* time, float* re, float* im) {
+        mImpl->Forward(time, re, im);
+    }
+
+    // size / 2 + 1 bins to size samples, scaled by 1 / size
+    void Inverse(float* time, const float* re, const float* im) {
+        mImpl->Inverse(time, re, im);
+    }
+
+private:
+    struct Impl {
+        virtual ~Impl() {}
+        virtual bool Init(size_t size) = 0;
+        virtual void Forward(const float* time, float* re, float* im) = 0;
+        virtual void Inverse(float* time, const float* re, const float* im) = 0;
+        size_t size = 0;
+    };
+
+    static uintptr_t Log2(size_t size) {
+        uintptr_t log2 = 0;
+        while (((size_t)1 << log2) < size) {
+            log2++;
+        }
+        return log2;
+    }
+
+    struct AudioFFTImpl : Impl {
+        bool Init(size_t size) override {
+            fft.init(size);
+            return true;
+        }
+
+        void Forward(const float* time, float* re, float* im) override {
+            fft.fft(time, re, im);
+        }
+
+        void Inverse(float* time, const float* re, const float* im) override {
+            fft.ifft(time, re, im);
+        }
+
+        audiofft::AudioFFT fft;
+    };
+
+    // WDL packs the Nyquist bin into bin 0's imaginary part and orders the
+    // other bins by WDL_fft_permute_tab(). Its inverse scales by 2 x size.
+    struct WdlImpl : Impl {
+        bool Init(size_t size) override {
+            if (size < 32 || size > 65536) { return false; }
+            WDL_fft_init();
+            permute = WDL_fft_permute_tab((int)size / 2);
+            if (permute == nullptr) { return false; }
+            buffer.resize(size);
+            return buffer.size() == size;
+        }
+
+        void Forward(const float* time, float* re, float* im) override {
+            const size_t half = size / 2;
+            WDL_FFT_REAL* data = buffer.data();
+            for (size_t i = 0; i < size; i++) {
+                data[i] = (WDL_FFT_REAL)time[i];
+            }
+            WDL_real_fft(data, (int)size, 0);
+            re[0] = (float)data[0];
+            im[0] = 0.f;
+            re[half] = (float)data[1];
+            im[half] = 0.f;
+            for (size_t k = 1; k < half; k++) {
+                const size_t i = 2 * (size_t)permute[k];
+                re[k] = (float)data[i];
+                im[k] = (float)data[i + 1];
+            }
+        }
+
+        void Inverse(float* time, const float* re, const float* im) override {
+            const size_t half = size / 2;
+            WDL_FFT_REAL* data = buffer.data();
+            data[0] = (WDL_FFT_REAL)re[0];
+            data[1] = (WDL_FFT_REAL)re[half];
+            for (size_t k = 1; k < half; k++) {
+                const size_t i = 2 * (size_t)permute[k];
+                data[i] = (WDL_FFT_REAL)re[k];
+                data[i + 1] = (WDL_FFT_REAL)im[k];
+            }
+            WDL_real_fft(data, (int)size, 1);
+            const float scale = 0.5f / (float)size;
+            for (size_t i = 0; i < size; i++) {
+                time[i] = (float)data[i] * scale;
+            }
+        }
+
+        AlignedBuffer<WDL_FFT_REAL> buffer;
+        const int* permute = nullptr;
+    };
+
+    // HISSTools follows vDSP: the forward transform is scaled by 2, the
+    // Nyquist bin is packed into bin 0's imaginary part, the inverse by size.
+    struct HISSToolsImpl : Impl {
+        ~HISSToolsImpl() {
+            if (setup != nullptr) {
+                hisstools_destroy_setup(setup);
+            }
+        }
+
+        bool Init(size_t size) override {
+            log2 = Log2(size);
+            hisstools_create_setup(&setup, log2);
+            realp.resize(size / 2);
+            imagp.resize(size / 2);
+            return setup != nullptr && realp.size() == size / 2 && imagp.size() == size / 2;
+        }
+
+        void Forward(const float* time, float* re, float* im) override {
+            const size_t half = size / 2;
+            FFT_SPLIT_COMPLEX_F split = { realp.data(), imagp.data() };
+            hisstools_rfft(setup, time, &split, size, log2);
+            re[0] = 0.5f * realp[0];
+            im[0] = 0.f;
+            re[half] = 0.5f * imagp[0];
+            im[half] = 0.f;
+            for (size_t k = 1; k < half; k++) {
+                re[k] = 0.5f * realp[k];
+                im[k] = 0.5f * imagp[k];
+            }
+        }
+
+        void Inverse(float* time, const float* re, const float* im) override {
+            const size_t half = size / 2;
+            realp[0] = re[0];
+            imagp[0] = re[half];
+            std::copy(re + 1, re + half, realp.data() + 1);
+            std::copy(im + 1, im + half, imagp.data() + 1);
+            FFT_SPLIT_COMPLEX_F split = { realp.data(), imagp.data() };
+            hisstools_rifft(setup, &split, time, log2);
+            const float scale = 1.f / (float)size;
+            for (size_t i = 0; i < size; i++) {
+                time[i] *= scale;
+            }
+        }
+
+        FFT_SETUP_F setup = nullptr;
+        uintptr_t log2 = 0;
+        AlignedBuffer<float> realp;
+        AlignedBuffer<float> imagp;
+    };
+
+    // A real FFT of size N is a complex FFT of N / 2 (even samples real, odd
+    // samples imaginary) plus one pass splitting the result. The complex FFT
+    // runs radix-4 Stockham passes (a radix-2 one last for odd powers of 2),
+    // which read one buffer and write the other in natural order, so there
+    // is no bit reversal. Every pass runs 4 butterflies per SIMD operation.
+    struct StockhamImpl : Impl {
+        struct Pass {
+            size_t length;       // n, the sub-transform length this pass splits
+            size_t stride;       // s, n * s == N / 2
+            size_t twiddles;     // offset of the w1, w2, w3 tables in mTwiddles, m = n / 4 each
+        };
+
+        bool Init(size_t size) override {
+            const size_t half = size / 2;
+            passes.clear();
+            size_t numTwiddles = 0;
+            for (size_t n = half, s = 1; n >= 2; s *= (n >= 4 ? 4 : 2), n /= (n >= 4 ? 4 : 2)) {
+                passes.push_back({ n, s, numTwiddles });
+                if (n >= 4) {
+                    numTwiddles += 6 * (n / 4);
+                }
+            }
+            twiddles.resize(numTwiddles + 2 * half);
+            work.resize(4 * half);
+            if (twiddles.size() != numTwiddles + 2 * half || work.size() != 4 * half) { return false; }
+
+            for (const Pass& pass : passes) {
+                if (pass.length < 4) { continue; }
+                const size_t m = pass.length / 4;
+                float* w = twiddles.data() + pass.twiddles;
+                for (size_t p = 0; p < m; p++) {
+                    for (size_t j = 1; j <= 3; j++) {
+                        const double angle = -2. * M_PI * (double)(j * p) / (double)pass.length;
+                        w[(2 * j - 2) * m + p] = (float)cos(angle);
+                        w[(2 * j - 1) * m + p] = (float)sin(angle);
+                    }
+                }
+            }
+            // e^(-2 pi i k / N) for splitting the real transform
+            splitRe = twiddles.data() + numTwiddles;
+            splitIm = splitRe + half;
+            for (size_t k = 0; k < half; k++) {
+                const double angle = -2. * M_PI * (double)k / (double)size;
+                splitRe[k] = (float)cos(angle);
+                splitIm[k] = (float)sin(angle);
+            }
+            return true;
+        }
+
+        void Forward(const float* time, float* re, float* im) override {
+            const size_t half = size / 2;
+            float* zRe = work.data();
+            float* zIm = zRe + half;
+            size_t i = 0;
+#if defined(TARGET_INTEL)
+            for (; i + 4 <= half; i += 4) {
+                const vFloat a = F32_VEC_ULOAD(time + 2 * i);
+                const vFloat b = F32_VEC_ULOAD(time + 2 * i + 4);
+                F32_VEC_USTORE(zRe + i, F32_VEC_SHUFFLE(a, b, 0x88));
+                F32_VEC_USTORE(zIm + i, F32_VEC_SHUFFLE(a, b, 0xDD));
+            }
+#endif
+            for (; i < half; i++) {
+                zRe[i] = time[2 * i];
+                zIm[i] = time[2 * i + 1];
+            }
+            const float* outRe;
+            const float* outIm;
+            Transform(zRe, zIm, outRe, outIm);
+
+            // X[k] = E[k] + w^k O[k], E = (Z[k] + conj(Z[N/2 - k])) / 2, O = (Z[k] - conj(Z[N/2 - k])) / 2i
+            re[0] = outRe[0] + outIm[0];
+            im[0] = 0.f;
+            re[half] = outRe[0] - outIm[0];
+            im[half] = 0.f;
+            for (size_t k = 1; k < half; k++) {
+                const float aRe = outRe[k], aIm = outIm[k];
+                const float bRe = outRe[half - k], bIm = -outIm[half - k];
+                const float eRe = 0.5f * (aRe + bRe), eIm = 0.5f * (aIm + bIm);
+                const float oRe = 0.5f * (aIm - bIm), oIm = -0.5f * (aRe - bRe);
+                re[k] = eRe + splitRe[k] * oRe - splitIm[k] * oIm;
+                im[k] = eIm + splitRe[k] * oIm + splitIm[k] * oRe;
+            }
+        }
+
+        void Inverse(float* time, const float* re, const float* im) override {
+            const size_t half = size / 2;
+            // The inverse is the forward transform with real and imaginary parts swapped on the way in and out
+            float* zIm = work.data();
+            float* zRe = zIm + half;
+            const float scale = 1.f / (float)size;
+            for (size_t k = 0; k < half; k++) {
+                const float aRe = re[k], aIm = im[k];
+                const float bRe = re[half - k], bIm = -im[half - k];
+                const float eRe = aRe + bRe, eIm = aIm + bIm;
+                const float dRe = aRe - bRe, dIm = aIm - bIm;
+                // O = (X[k] - conj(X[N/2 - k])) w^-k, Z[k] = E + i O
+                const float oRe = dRe * splitRe[k] + dIm * splitIm[k];
+                const float oIm = dIm * splitRe[k] - dRe * splitIm[k];
+                zRe[k] = scale * (eRe - oIm);
+                zIm[k] = scale * (eIm + oRe);
+            }
+            const float* outIm;
+            const float* outRe;
+            Transform(zIm, zRe, outIm, outRe);
+            size_t i = 0;
+#if defined(TARGET_INTEL)
+            for (; i + 4 <= half; i += 4) {
+                const vFloat a = F32_VEC_ULOAD(outRe + i);
+                const vFloat b = F32_VEC_ULOAD(outIm + i);
+                F32_VEC_USTORE(time + 2 * i, _mm_unpacklo_ps(a, b));
+                F32_VEC_USTORE(time + 2 * i + 4, _mm_unpackhi_ps(a, b));
+            }
+#endif
+            for (; i < half; i++) {
+                time[2 * i] = outRe[i];
+                time[2 * i + 1] = outIm[i];
+            }
+        }
+
+        // Complex forward FFT of N / 2 points in the first half of work, the passes
+        // alternate between the halves, out points to the one holding the result
+        void Transform(float* xRe, float* xIm, const float*& outRe, const float*& outIm) {
+            const size_t half = size / 2;
+            float* yRe = work.data() + 2 * half;
+            float* yIm = yRe + half;
+            for (const Pass& pass : passes) {
+                if (pass.length >= 4) {
+                    Radix4(pass, xRe, xIm, yRe, yIm);
+                }
+                else {
+                    Radix2(pass, xRe, xIm, yRe, yIm);
+                }
+                std::swap(xRe, yRe);
+                std::swap(xIm, yIm);
+            }
+            outRe = xRe;
+            outIm = xIm;
+        }
+
+        void Radix4(const Pass& pass, const float* xRe, const float* xIm, float* yRe, float* yIm) const {
+            const size_t m = pass.length / 4;
+            const size_t s = pass.stride;
+            const float* w = twiddles.data() + pass.twiddles;
+            const float* w1Re = w;
+            const float* w1Im = w + m;
+            const float* w2Re = w + 2 * m;
+            const float* w2Im = w + 3 * m;
+            const float* w3Re = w + 4 * m;
+            const float* w3Im = w + 5 * m;
+#if defined(TARGET_INTEL)
+            if (s == 1 && m >= 4) {
+                // Four values of p per vector, transposed so y[4p..4p+3] are stored together
+                for (size_t p = 0; p < m; p += 4) {
+                    vFloat outRe[4], outIm[4];
+                    Butterfly4(F32_VEC_ULOAD(xRe + p), F32_VEC_ULOAD(xIm + p), F32_VEC_ULOAD(xRe + p + m), F32_VEC_ULOAD(xIm + p + m),
+                        F32_VEC_ULOAD(xRe + p + 2 * m), F32_VEC_ULOAD(xIm + p + 2 * m), F32_VEC_ULOAD(xRe + p + 3 * m), F32_VEC_ULOAD(xIm + p + 3 * m),
+                        F32_VEC_ULOAD(w1Re + p), F32_VEC_ULOAD(w1Im + p), F32_VEC_ULOAD(w2Re + p), F32_VEC_ULOAD(w2Im + p),
+                        F32_VEC_ULOAD(w3Re + p), F32_VEC_ULOAD(w3Im + p), outRe, outIm);
+                    _MM_TRANSPOSE4_PS(outRe[0], outRe[1], outRe[2], outRe[3]);
+                    _MM_TRANSPOSE4_PS(outIm[0], outIm[1], outIm[2], outIm[3]);
+                    for (size_t j = 0; j < 4; j++) {
+                        F32_VEC_USTORE(yRe + 4 * p + 4 * j, outRe[j]);
+                        F32_VEC_USTORE(yIm + 4 * p + 4 * j, outIm[j]);
+                    }
+                }
+                return;
+            }
+            if (s >= 4) {
+                for (size_t p = 0; p < m; p++) {
+                    const vFloat v1Re = float2vector(w1Re[p]), v1Im = float2vector(w1Im[p]);
+                    const vFloat v2Re = float2vector(w2Re[p]), v2Im = float2vector(w2Im[p]);
+                    const vFloat v3Re = float2vector(w3Re[p]), v3Im = float2vector(w3Im[p]);
+                    const size_t in = s * p;
+                    const size_t out = 4 * s * p;
+                    for (size_t q = 0; q < s; q += 4) {
+                        vFloat outRe[4], outIm[4];
+                        Butterfly4(F32_VEC_ULOAD(xRe + in + q), F32_VEC_ULOAD(xIm + in + q),
+                            F32_VEC_ULOAD(xRe + in + s * m + q), F32_VEC_ULOAD(xIm + in + s * m + q),
+                            F32_VEC_ULOAD(xRe + in + 2 * s * m + q), F32_VEC_ULOAD(xIm + in + 2 * s * m + q),
+                            F32_VEC_ULOAD(xRe + in + 3 * s * m + q), F32_VEC_ULOAD(xIm + in + 3 * s * m + q),
+                            v1Re, v1Im, v2Re, v2Im, v3Re, v3Im, outRe, outIm);
+                        for (size_t j = 0; j < 4; j++) {
+                            F32_VEC_USTORE(yRe + out + j * s + q, outRe[j]);
+                            F32_VEC_USTORE(yIm + out + j * s + q, outIm[j]);
+                        }
+                    }
+                }
+                return;
+            }
+#endif
+            for (size_t p = 0; p < m; p++) {
+                for (size_t q = 0; q < s; q++) {
+                    const size_t a = q + s * p;
+                    const float aRe = xRe[a], aIm = xIm[a];
+                    const float bRe = xRe[a + s * m], bIm = xIm[a + s * m];
+                    const float cRe = xRe[a + 2 * s * m], cIm = xIm[a + 2 * s * m];
+                    const float dRe = xRe[a + 3 * s * m], dIm = xIm[a + 3 * s * m];
+                    const float apcRe = aRe + cRe, apcIm = aIm + cIm;
+                    const float amcRe = aRe - cRe, amcIm = aIm - cIm;
+                    const float bpdRe = bRe + dRe, bpdIm = bIm + dIm;
+                    // i (b - d)
+                    const float jbmdRe = dIm - bIm, jbmdIm = bRe - dRe;
+                    const size_t out = q + 4 * s * p;
+                    const float y1Re = amcRe - jbmdRe, y1Im = amcIm - jbmdIm;
+                    const float y2Re = apcRe - bpdRe, y2Im = apcIm - bpdIm;
+                    const float y3Re = amcRe + jbmdRe, y3Im = amcIm + jbmdIm;
+                    yRe[out] = apcRe + bpdRe;
+                    yIm[out] = apcIm + bpdIm;
+                    yRe[out + s] = y1Re * w1Re[p] - y1Im * w1Im[p];
+                    yIm[out + s] = y1Re * w1Im[p] + y1Im * w1Re[p];
+                    yRe[out + 2 * s] = y2Re * w2Re[p] - y2Im * w2Im[p];
+                    yIm[out + 2 * s] = y2Re * w2Im[p] + y2Im * w2Re[p];
+                    yRe[out + 3 * s] = y3Re * w3Re[p] - y3Im * w3Im[p];
+                    yIm[out + 3 * s] = y3Re * w3Im[p] + y3Im * w3Re[p];
+                }
+            }
+        }
+
+        // The last pass for odd powers of 2, n == 2 so there are no twiddles
+        static void Radix2(const Pass& pass, const float* xRe, const float* xIm, float* yRe, float* yIm) {
+            const size_t s = pass.stride;
+            size_t q = 0;
+#if defined(TARGET_INTEL)
+            for (; q + 4 <= s; q += 4) {
+                const vFloat aRe = F32_VEC_ULOAD(xRe + q), aIm = F32_VEC_ULOAD(xIm + q);
+                const vFloat bRe = F32_VEC_ULOAD(xRe + q + s), bIm = F32_VEC_ULOAD(xIm + q + s);
+                F32_VEC_USTORE(yRe + q, F32_VEC_ADD_OP(aRe, bRe));
+                F32_VEC_USTORE(yIm + q, F32_VEC_ADD_OP(aIm, bIm));
+                F32_VEC_USTORE(yRe + q + s, F32_VEC_SUB_OP(aRe, bRe));
+                F32_VEC_USTORE(yIm + q + s, F32_VEC_SUB_OP(aIm, bIm));
+            }
+#endif
+            for (; q < s; q++) {
+                const float aRe = xRe[q], aIm = xIm[q];
+                const float bRe = xRe[q + s], bIm = xIm[q + s];
+                yRe[q] = aRe + bRe;
+                yIm[q] = aIm + bIm;
+                yRe[q + s] = aRe - bRe;
+                yIm[q + s] = aIm - bIm;
+            }
+        }
+
+#if defined(TARGET_INTEL)
+        static vFloat MulRe(vFloat aRe, vFloat aIm, vFloat bRe, vFloat bIm) {
+            return F32_VEC_SUB_OP(F32_VEC_MUL_OP(aRe, bRe), F32_VEC_MUL_OP(aIm, bIm));
+        }
+
+        static vFloat MulIm(vFloat aRe, vFloat aIm, vFloat bRe, vFloat bIm) {
+            return F32_VEC_ADD_OP(F32_VEC_MUL_OP(aRe, bIm), F32_VEC_MUL_OP(aIm, bRe));
+        }
+
+        static void Butterfly4(vFloat aRe, vFloat aIm, vFloat bRe, vFloat bIm, vFloat cRe, vFloat cIm, vFloat dRe, vFloat dIm,
+            vFloat w1Re, vFloat w1Im, vFloat w2Re, vFloat w2Im, vFloat w3Re, vFloat w3Im, vFloat* outRe, vFloat* outIm) {
+            const vFloat apcRe = F32_VEC_ADD_OP(aRe, cRe), apcIm = F32_VEC_ADD_OP(aIm, cIm);
+            const vFloat amcRe = F32_VEC_SUB_OP(aRe, cRe), amcIm = F32_VEC_SUB_OP(aIm, cIm);
+            const vFloat bpdRe = F32_VEC_ADD_OP(bRe, dRe), bpdIm = F32_VEC_ADD_OP(bIm, dIm);
+            const vFloat jbmdRe = F32_VEC_SUB_OP(dIm, bIm), jbmdIm = F32_VEC_SUB_OP(bRe, dRe);
+            const vFloat y1Re = F32_VEC_SUB_OP(amcRe, jbmdRe), y1Im = F32_VEC_SUB_OP(amcIm, jbmdIm);
+            const vFloat y2Re = F32_VEC_SUB_OP(apcRe, bpdRe), y2Im = F32_VEC_SUB_OP(apcIm, bpdIm);
+            const vFloat y3Re = F32_VEC_ADD_OP(amcRe, jbmdRe), y3Im = F32_VEC_ADD_OP(amcIm, jbmdIm);
+            outRe[0] = F32_VEC_ADD_OP(apcRe, bpdRe);
+            outIm[0] = F32_VEC_ADD_OP(apcIm, bpdIm);
+            outRe[1] = MulRe(y1Re, y1Im, w1Re, w1Im);
+            outIm[1] = MulIm(y1Re, y1Im, w1Re, w1Im);
+            outRe[2] = MulRe(y2Re, y2Im, w2Re, w2Im);
+            outIm[2] = MulIm(y2Re, y2Im, w2Re, w2Im);
+            outRe[3] = MulRe(y3Re, y3Im, w3Re, w3Im);
+            outIm[3] = MulIm(y3Re, y3Im, w3Re, w3Im);
+        }
+#endif
+
+        std::vector<Pass> passes;
+        AlignedBuffer<float> twiddles;   // per radix-4 pass w1re, w1im, w2re, w2im, w3re, w3im, then the split twiddles
+        AlignedBuffer<float> work;       // two complex buffers of N / 2
+        float* splitRe = nullptr;
+        float* splitIm = nullptr;
+    };
+
+    // Textbook in-place radix-2 on the full complex sequence, in double
+    // precision. The yardstick the benchmark measures the others against.
+    struct ReferenceImpl : Impl {
+        bool Init(size_t size) override {
+            data.assign(size, std::complex<double>());
+            roots.resize(size / 2);
+            for (size_t k = 0; k < size / 2; k++) {
+                roots[k] = std::polar(1., -2. * M_PI * (double)k / (double)size);
+            }
+            return true;
+        }
+
+        void Forward(const float* time, float* re, float* im) override {
+            for (size_t i = 0; i < size; i++) {
+                data[i] = std::complex<double>(time[i], 0.);
+            }
+            Transform(false);
+            for (size_t k = 0; k <= size / 2; k++) {
+                re[k] = (float)data[k].real();
+                im[k] = (float)data[k].imag();
+            }
+        }
+
+        void Inverse(float* time, const float* re, const float* im) override {
+            const size_t half = size / 2;
+            for (size_t k = 0; k <= half; k++) {
+                data[k] = std::complex<double>(re[k], im[k]);
+            }
+            for (size_t k = half + 1; k < size; k++) {
+                data[k] = std::conj(data[size - k]);
+            }
+            Transform(true);
+            for (size_t i = 0; i < size; i++) {
+                time[i] = (float)(data[i].real() / (double)size);
+            }
+        }
+
+        void Transform(bool inverse) {
+            for (size_t i = 1, j = 0; i < size; i++) {
+                size_t bit = size >> 1;
+                for (; j & bit; bit >>= 1) {
+                    j ^= bit;
+                }
+                j ^= bit;
+                if (i < j) {
+                    std::swap(data[i], data[j]);
+                }
+            }
+            for (size_t length = 2; length <= size; length <<= 1) {
+                const size_t step = size / length;
+                for (size_t i = 0; i < size; i += length) {
+                    for (size_t j = 0; j < length / 2; j++) {
+                        const std::complex<double> w = inverse ? std::conj(roots[j * step]) : roots[j * step];
+                        const std::complex<double> u = data[i + j];
+                        const std::complex<double> v = data[i + j + length / 2] * w;
+                        data[i + j] = u + v;
+                        data[i + j + length / 2] = u - v;
+                    }
+                }
+            }
+        }
+
+        std::vector<std::complex<double>> data;
+        std::vector<std::complex<double>> roots;
+    };
+
+    Backend mBackend;
+    Backend mImplBackend = kDefaultBackend;
+    std::unique_ptr<Impl> mImpl;
+};
+
+END_IPLUG_NAMESPACE
@@ -2,72 +2,133 @@
 
 #include "IPlugConstants.h"
 #include "TwoStageFFTConvolver.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
 #include <vector>
+#include <memory>
+#include <mutex>
 
 BEGIN_IPLUG_NAMESPACE
 
-class TwoStageConvolver {
+// Runs the tail stage of TwoStageFFTConvolver on the shared ThreadPool.
+// The result is needed one tail block later, which is the task's deadline.
+class PooledTwoStageFFTConvolver : public fftconvolver::TwoStageFFTConvolver {
 public:
-    TwoStageConvolver()
-    {
+    PooledTwoStageFFTConvolver(std::shared_ptr<ThreadPool> pool, ThreadPool::Clock::duration deadline) :
+        mPool(pool),
+        mDeadline(deadline),
+        mTask(&PooledTwoStageFFTConvolver::Run, this)
+    {}
+
+    ~PooledTwoStageFFTConvolver() {
+        mPool->Remove(mTask);
     }
-    ~TwoStageConvolver() {}
 
-    void OnReset() {
-        /*if (mConvolver == nullptr) { return; }
-        mConvolver.reset();*/
+    void SetDeadline(ThreadPool::Clock::duration deadline) {
+        mDeadline = deadline;
     }
 
-    int SetIr(float* ir, size_t length) {
-        std::unique_ptr<fftconvolver::TwoStageFFTConvolver> temp = std::make_unique<fftconvolver::TwoStageFFTConvolver>();
-        if (temp == nullptr) { return -1; }
-
-        mIR.resize(length);
-        for (int i = 0; i < length; i++) {
-            mIR[i] = static_cast<fftconvolver::Sample>(ir[i]);
-        }
+    // Settles a tail still queued from the audio thread, call before init() on a swapped out engine
+    void Prepare(ThreadPool::Clock::duration deadline) {
+        mPool->Remove(mTask);
+        mDeadline = deadline;
+    }
 
-        if (!temp->init(kHeadBlockSize, kTailBlockSize, mIR.data(), length)) {
-            return -1;
-        }
+protected:
+    void startBackgroundProcessing() override {
+        mPool->Submit(mTask, ThreadPool::Clock::now() + mDeadline);
+    }
 
-        mConvolver = std::move(temp);
+    void waitForBackgroundProcessing() override {
+        TRACE_SCOPE("TwoStageConvolver::waitTail");
+        mPool->Wait(mTask);
+    }
 
-        mCanProcess = true;
-        return 0;
+private:
+    static void Run(void* context) {
+        TRACE_SCOPE("TwoStageConvolver::tail");
+        static_cast<PooledTwoStageFFTConvolver*>(context)->doBackgroundProcessing();
     }
 
-    int SetIr(double* ir, size_t length) {
-        std::unique_ptr<fftconvolver::TwoStageFFTConvolver> temp = std::make_unique<fftconvolver::TwoStageFFTConvolver>();
-        if (temp == nullptr) { return -1; }
+    std::shared_ptr<ThreadPool> mPool;
+    ThreadPool::Clock::duration mDeadline;
+    ThreadPool::Task mTask;
+};
 
-        mIR.resize(length);
-        for (int i = 0; i < length; i++) {
-            mIR[i] = static_cast<fftconvolver::Sample>(ir[i]);
-        }
+class TwoStageConvolver {
+public:
+    static constexpr size_t kDefaultHeadBlockSize = 128;
+    static constexpr size_t kDefaultTailBlockSize = 1024;
+
+    TwoStageConvolver(size_t headBlockSize = kDefaultHeadBlockSize, size_t tailBlockSize = kDefaultTailBlockSize) :
+        mInput(kMaxChunk),
+        mOutput(kMaxChunk),
+        mPool(ThreadPool::Get()),
+        mHeadBlockSize(headBlockSize),
+        mTailBlockSize(tailBlockSize)
+    {
+    }
+    ~TwoStageConvolver() {}
 
-        if (!temp->init(kHeadBlockSize, kTailBlockSize, mIR.data(), length)) {
-            return -1;
+    void OnReset(double sampleRate) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mSampleRate = sampleRate;
+        if (mConvolver != nullptr) {
+            mConvolver->SetDeadline(GetTailDeadline(mActiveTailBlockSize));
         }
+    }
 
-        mConvolver = std::move(temp);
+    // Partition sizes of the head and the tail stage, take effect on the next SetIr()
+    void SetBlockSizes(size_t headBlockSize, size_t tailBlockSize) {
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        mHeadBlockSize = headBlockSize;
+        mTailBlockSize = tailBlockSize;
+    }
 
-        mCanProcess = true;
-        return 0;
+    int SetIr(const float* ir, size_t length) {
+        return Init(ir, length);
     }
 
-    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
-        if (mCanProcess) {
-            mInput.resize(nFrames);
-            for (int i = 0; i < nFrames; i++) {
-                mInput[i] = static_cast<fftconvolver::Sample>(inputs[0][i]);
-            }
+    int SetIr(const double* ir, size_t length) {
+        return Init(ir, length);
+    }
+
+    // Frees the engine and its spare, process() passes the input through until the next SetIr()
+    void Clear() {
+        std::unique_ptr<PooledTwoStageFFTConvolver> convolver;
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mConvolver.swap(convolver);
+            mLength = 0;
+            mCanProcess = false;
+        }
+        mSpare.reset();
+        std::vector<fftconvolver::Sample>().swap(mConverted);
+    }
 
-            mOutput.resize(nFrames);
-            mConvolver->process(mInput.data(), mOutput.data(), nFrames);
+    // Estimate: head and tail spectra plus input history, each about twice the IR length
+    size_t GetMemoryUsage() const {
+        return mCanProcess ? 4 * mLength * sizeof(fftconvolver::Sample) : 0;
+    }
 
-            for (int i = 0; i < nFrames; i++) {
-                outputs[0][i] = static_cast<iplug::sample>(mOutput[i]);
+    void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("TwoStageConvolver::process");
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (lock.owns_lock() && mCanProcess) {
+            // Converted in chunks, so the host block size never resizes the buffers here
+            for (int pos = 0; pos < nFrames; pos += kMaxChunk) {
+                const int count = std::min(kMaxChunk, nFrames - pos);
+                for (int i = 0; i < count; i++) {
+                    mInput[i] = static_cast<fftconvolver::Sample>(inputs[0][pos + i]);
+                }
+
+                mConvolver->process(mInput.data(), mOutput.data(), count);
+
+                for (int i = 0; i < count; i++) {
+                    outputs[0][pos + i] = static_cast<iplug::sample>(mOutput[i]);
+                }
             }
             return;
         }
@@ -77,12 +138,67 @@ public:
     }
 
 private:
-    static constexpr const size_t kHeadBlockSize = 128;
-    static constexpr const size_t kTailBlockSize = 1024;
-    std::vector<fftconvolver::Sample> mIR;
+    static constexpr int kMaxChunk = 512;
+
+    // The IR is only borrowed for init(), a converted copy is made only when sample types differ.
+    // The new IR is built in the spare while the current engine keeps playing, then the two swap.
+    // Upstream init() starts with reset(), which frees the spare's buffers, so none are reused.
+    template <typename T>
+    int Init(const T* ir, size_t length) {
+        TRACE_SCOPE("TwoStageConvolver::SetIr");
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        if (mSpare == nullptr) {
+            mSpare = std::make_unique<PooledTwoStageFFTConvolver>(mPool, GetTailDeadline(mTailBlockSize));
+            if (mSpare == nullptr) { return -1; }
+        }
+        else {
+            mSpare->Prepare(GetTailDeadline(mTailBlockSize));
+        }
+
+        const fftconvolver::Sample* samples = Borrow(ir, length, mConverted);
+
+        if (!mSpare->init(mHeadBlockSize, mTailBlockSize, samples, length)) {
+            return -1;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mConvolver.swap(mSpare);
+            mActiveTailBlockSize = mTailBlockSize;
+            mLength = length;
+            mCanProcess = true;
+        }
+        return 0;
+    }
+
+    // A tail block is due one tail block after it was started
+    ThreadPool::Clock::duration GetTailDeadline(size_t tailBlockSize) const {
+        return std::chrono::duration_cast<ThreadPool::Clock::duration>(std::chrono::duration<double>(tailBlockSize / mSampleRate));
+    }
+
+    static const fftconvolver::Sample* Borrow(const fftconvolver::Sample* ir, size_t length, std::vector<fftconvolver::Sample>& converted) {
+        return ir;
+    }
+
+    template <typename T>
+    static const fftconvolver::Sample* Borrow(const T* ir, size_t length, std::vector<fftconvolver::Sample>& converted) {
+        converted.assign(ir, ir + length);
+        return converted.data();
+    }
+
     std::vector<fftconvolver::Sample> mInput;
     std::vector<fftconvolver::Sample> mOutput;
-    std::unique_ptr<fftconvolver::TwoStageFFTConvolver> mConvolver;
+    std::shared_ptr<ThreadPool> mPool;
+    std::mutex mMutex;
+    std::mutex mBuildMutex;
+    std::unique_ptr<PooledTwoStageFFTConvolver> mConvolver;
+    std::unique_ptr<PooledTwoStageFFTConvolver> mSpare;
+    size_t mHeadBlockSize;
+    size_t mTailBlockSize;
+    size_t mActiveTailBlockSize = kDefaultTailBlockSize;
+    std::vector<fftconvolver::Sample> mConverted;
+    double mSampleRate = 44100.;
+    size_t mLength = 0;
     bool mCanProcess = false;
 };
 
@@ -2,98 +2,110 @@
 
 #include "convoengine.h"
 #include "IPlugConstants.h"
+#include "Trace.h"
 #include <math.h>
 #include <memory>
+#include <mutex>
 
 BEGIN_IPLUG_NAMESPACE
 
+// Engines are fed the host buffers directly (SAMPLE_TYPE_FLOAT with WDL_FFT_REALSIZE=4)
+static_assert(sizeof(iplug::sample) == sizeof(WDL_FFT_REAL), "WdlConvolver needs iplug::sample and WDL_FFT_REAL to match");
+
+// WDL_ConvolutionEngine_Div, or with WDL_CONVO_THREAD defined project wide,
+// WDL_ConvolutionEngine_Thread for long IRs - the head is convolved in
+// process() and the long tail partitions on WDL's helper thread.
+// New engines are built outside the audio thread and swapped in under a
+// lock the audio thread only ever try-locks, so process() never waits or allocates.
+// Replaced engines are kept as spares and rebuilt in place by the next SetIr(),
+// WDL keeps their buffers when the new IR is no longer than the old one.
 class WdlConvolver {
 public:
-    WdlConvolver(){}
+    WdlConvolver(bool threaded = false) :
+        mThreaded(threaded)
+    {}
     ~WdlConvolver() {}
 
     void OnReset() {
+        std::lock_guard<std::mutex> lock(mMutex);
         if (mEngine != nullptr) {
             mEngine->Reset();
         }
-    }
-
-    int SetIr(float* ir, size_t length, double sampleRate, int blocksize) {
-        mCanProcess = false;
-        mImpulse = std::make_unique<WDL_ImpulseBuffer>();
-
-        mImpulse->SetNumChannels(1);
-        if (length > mImpulse->SetLength(length)) {
-            return 1;
-        }
-        mImpulse->samplerate = sampleRate;
-
-        WDL_FFT_REAL* buffPtr = mImpulse->impulses[0].Get();
-        for (int i = 0; i < length; i++) {
-            buffPtr[i] = static_cast<WDL_FFT_REAL>(ir[i]);
-        }
-
-        mEngine = std::make_unique< WDL_ConvolutionEngine_Div>();
-        if (mEngine == nullptr) {
-            return 1;
+#if defined(WDL_CONVO_THREAD)
+        if (mThreadEngine != nullptr) {
+            mThreadEngine->Reset();
         }
-
-        mEngine->Reset();
-        mEngine->SetImpulse(mImpulse.get(), 0, blocksize);
-        mCanProcess = true;
-        return 0;
+#endif
     }
 
-    int SetIr(double* ir, size_t length, double sampleRate, int blocksize) {
-        mCanProcess = false;
-        mImpulse = std::make_unique<WDL_ImpulseBuffer>();
+    // Takes effect on the next SetIr()
+    void SetThreaded(bool threaded) {
+        mThreaded = threaded;
+    }
 
-        mImpulse->SetNumChannels(1);
-        if (length > mImpulse->SetLength(length)) {
-            return 1;
-        }
-        mImpulse->samplerate = sampleRate;
+    int SetIr(const float* ir, size_t length, double sampleRate, int blocksize) {
+        return Init(ir, length, sampleRate, blocksize);
+    }
 
-        WDL_FFT_REAL* buffPtr = mImpulse->impulses[0].Get();
-        for (int i = 0; i < length; i++) {
-            buffPtr[i] = static_cast<WDL_FFT_REAL>(ir[i]);
-        }
+    int SetIr(const double* ir, size_t length, double sampleRate, int blocksize) {
+        return Init(ir, length, sampleRate, blocksize);
+    }
 
-        mEngine = std::make_unique< WDL_ConvolutionEngine_Div>();
-        if (mEngine == nullptr) {
-            return 1;
+    // Frees the engines, their spares and the impulse, process() passes the input through until the next SetIr()
+    void Clear() {
+        std::unique_ptr<WDL_ConvolutionEngine_Div> engine;
+#if defined(WDL_CONVO_THREAD)
+        std::unique_ptr<WDL_ConvolutionEngine_Thread> threadEngine;
+#endif
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mEngine.swap(engine);
+#if defined(WDL_CONVO_THREAD)
+            mThreadEngine.swap(threadEngine);
+#endif
+            mLength = 0;
+            mCanProcess = false;
         }
+        mSpare.reset();
+#if defined(WDL_CONVO_THREAD)
+        mThreadSpare.reset();
+#endif
+        mImpulse.SetLength(0);
+    }
 
-        mEngine->Reset();
-        mEngine->SetImpulse(mImpulse.get(), 0, blocksize);
-        mCanProcess = true;
-        return 0;
+    // Estimate: partition spectra plus input history, each about twice the IR length
+    size_t GetMemoryUsage() const {
+        return mCanProcess ? 4 * mLength * sizeof(WDL_FFT_REAL) : 0;
     }
 
+    // Output is delayed by this many samples, report it with SetLatency()
     int GetLatency() {
-        if (mEngine == nullptr) { return 0; }
-        return mEngine->GetLatency();
+        return mLatency;
+    }
+
+    bool IsThreaded() {
+#if defined(WDL_CONVO_THREAD)
+        return mThreadEngine != nullptr;
+#else
+        return false;
+#endif
     }
 
     void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        TRACE_SCOPE("WdlConvolver::process");
         iplug::sample* inPtr = inputs[0];
         iplug::sample* outPtr = outputs[0];
-        if (mCanProcess) {
-            mEngine->Add((WDL_FFT_REAL**)inputs, nFrames, 1);
-            int nAvailableSamples = wdl_min(mEngine->Avail(nFrames), nFrames);
-
-            // If not enough samples are available yet, then only output the dry signal
-            const unsigned long unprocessed = nFrames - nAvailableSamples;
 
-            if (nAvailableSamples < nFrames) {
-                memset(outPtr, 0, unprocessed);
+        std::unique_lock<std::mutex> lock(mMutex, std::try_to_lock);
+        if (lock.owns_lock() && mCanProcess) {
+#if defined(WDL_CONVO_THREAD)
+            if (mThreadEngine != nullptr) {
+                Process(*mThreadEngine, inPtr, outPtr, nFrames);
+                return;
             }
-
-            WDL_FFT_REAL* convOut = mEngine->Get()[0];
-            if ((nAvailableSamples > 0) && (nFrames > 0) && (nAvailableSamples <= nFrames)) {
-                memcpy(&outPtr[unprocessed], convOut, nAvailableSamples * sizeof(iplug::sample));
-            }
-            mEngine->Advance(nAvailableSamples);
+#endif
+            Process(*mEngine, inPtr, outPtr, nFrames);
             return;
         }
         for (int s = 0; s < nFrames; s++) {
@@ -102,10 +114,115 @@ public:
     }
 
 private:
-    std::unique_ptr<WDL_ImpulseBuffer> mImpulse;
-    std::unique_ptr<WDL_ConvolutionEngine_Div> mEngine;
+    // IRs shorter than this have no tail worth a helper thread
+    static constexpr size_t kThreadedMinLength = 16384;
+
+    template <typename Engine>
+    static void Process(Engine& engine, iplug::sample* inPtr, iplug::sample* outPtr, int nFrames) {
+        WDL_FFT_REAL* in = reinterpret_cast<WDL_FFT_REAL*>(inPtr);
+        engine.Add(&in, nFrames, 1);
+        int nAvailableSamples = wdl_min(engine.Avail(nFrames), nFrames);
+
+        // Until the engine has caught up with its latency the front of the block is silent
+        const int unprocessed = nFrames - nAvailableSamples;
+        if (unprocessed > 0) {
+            memset(outPtr, 0, unprocessed * sizeof(iplug::sample));
+        }
+
+        if (nAvailableSamples > 0) {
+            WDL_FFT_REAL* convOut = engine.Get()[0];
+            memcpy(&outPtr[unprocessed], convOut, nAvailableSamples * sizeof(iplug::sample));
+            engine.Advance(nAvailableSamples);
+        }
+    }
 
+    // The engine copies the impulse into its own spectra, the impulse buffer is kept only to reuse its memory
+    template <typename T>
+    int Init(const T* ir, size_t length, double sampleRate, int blocksize) {
+        TRACE_SCOPE("WdlConvolver::SetIr");
+        std::lock_guard<std::mutex> buildLock(mBuildMutex);
+
+        mImpulse.SetNumChannels(1);
+        if (length > mImpulse.SetLength(length)) {
+            return 1;
+        }
+        mImpulse.samplerate = sampleRate;
+
+        WDL_FFT_REAL* buffPtr = mImpulse.impulses[0].Get();
+        for (int i = 0; i < length; i++) {
+            buffPtr[i] = static_cast<WDL_FFT_REAL>(ir[i]);
+        }
+
+        // Only one of the engines is in use, the other one's spare stays parked
+        bool threaded = false;
+        int latency = 0;
+#if defined(WDL_CONVO_THREAD)
+        if (mThreaded && length >= kThreadedMinLength) {
+            if (mThreadSpare == nullptr) {
+                mThreadSpare = std::make_unique<WDL_ConvolutionEngine_Thread>();
+            }
+            mThreadSpare->SetImpulse(&mImpulse, -1, blocksize);
+            latency = mThreadSpare->GetLatency();
+            threaded = true;
+        }
+        else
+#endif
+        {
+            if (mSpare == nullptr) {
+                mSpare = std::make_unique<WDL_ConvolutionEngine_Div>();
+            }
+            mSpare->SetImpulse(&mImpulse, -1, blocksize);
+            latency = mSpare->GetLatency();
+        }
+
+        // The engine in use swaps with its spare, one of the other kind becomes its spare.
+        // A spare pushed out is released after the lock, outside the audio thread.
+#if defined(WDL_CONVO_THREAD)
+        std::unique_ptr<WDL_ConvolutionEngine_Div> released;
+        std::unique_ptr<WDL_ConvolutionEngine_Thread> releasedThread;
+#endif
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+#if defined(WDL_CONVO_THREAD)
+            if (threaded) {
+                mThreadEngine.swap(mThreadSpare);
+                if (mEngine != nullptr) {
+                    released = std::move(mSpare);
+                    mSpare = std::move(mEngine);
+                }
+            }
+            else {
+                mEngine.swap(mSpare);
+                if (mThreadEngine != nullptr) {
+                    releasedThread = std::move(mThreadSpare);
+                    mThreadSpare = std::move(mThreadEngine);
+                }
+            }
+#else
+            (void)threaded;
+            mEngine.swap(mSpare);
+#endif
+            mLatency = latency;
+            mLength = length;
+            mCanProcess = true;
+        }
+        return 0;
+    }
+
+    std::mutex mMutex;
+    std::mutex mBuildMutex;
+    std::unique_ptr<WDL_ConvolutionEngine_Div> mEngine;
+    std::unique_ptr<WDL_ConvolutionEngine_Div> mSpare;
+#if defined(WDL_CONVO_THREAD)
+    std::unique_ptr<WDL_ConvolutionEngine_Thread> mThreadEngine;
+    std::unique_ptr<WDL_ConvolutionEngine_Thread> mThreadSpare;
+#endif
+    WDL_ImpulseBuffer mImpulse;
+
+    bool mThreaded = false;
+    int mLatency = 0;
+    size_t mLength = 0;
     bool mCanProcess = false;
 };
 
-END_IPLUG_NAMESPACE
\ No newline at end of file
+END_IPLUG_NAMESPACE
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "AlignedBuffer.h"
+#include <cstddef>
+
+// One aligned block carved into consecutive buffers. The block only grows,
+// so rebuilding an engine of the same or a smaller size reuses the same
+// memory and keeps all of its buffers next to each other:
+//
+//     arena.Begin();
+//     size_t a = arena.Reserve<float>(n);
+//     size_t b = arena.Reserve<float>(m);
+//     if (!arena.Commit()) { ... }
+//     float* pa = arena.Get<float>(a);
+class AlignedArena {
+public:
+    static constexpr size_t kAlignment = AlignedBuffer<unsigned char>::kAlignment;
+    static constexpr size_t kMaxBuffers = 32;
+
+    void Begin() {
+        mNumBuffers = 0;
+        mUsed = 0;
+        mOverflow = false;
+    }
+
+    // Returns the buffer's index for Get(), every buffer starts on a SIMD boundary
+    template <typename T>
+    size_t Reserve(size_t count) {
+        if (mNumBuffers == kMaxBuffers) {
+            mOverflow = true;
+            return 0;
+        }
+        mOffsets[mNumBuffers] = mUsed;
+        mUsed += (count * sizeof(T) + kAlignment - 1) & ~(kAlignment - 1);
+        return mNumBuffers++;
+    }
+
+    // Allocates only if the reserved buffers outgrew the block, all of them start zeroed.
+    // False when out of memory or past kMaxBuffers.
+    bool Commit() {
+        mMemory.resize(mUsed);
+        return !mOverflow && mMemory.size() == mUsed;
+    }
+
+    template <typename T>
+    T* Get(size_t index) {
+        return reinterpret_cast<T*>(mMemory.data() + mOffsets[index]);
+    }
+
+    size_t GetCapacity() const {
+        return mMemory.GetBytes();
+    }
+
+private:
+    AlignedBuffer<unsigned char> mMemory;
+    size_t mOffsets[kMaxBuffers] = {};
+    size_t mNumBuffers = 0;
+    size_t mUsed = 0;
+    bool mOverflow = false;
+};
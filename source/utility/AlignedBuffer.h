@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+// Owning, SIMD aligned array of trivially copyable samples.
+// Keeps the std::vector names (data, size, resize) used around the resamplers.
+template <typename T>
+class AlignedBuffer {
+public:
+    static constexpr size_t kAlignment = 32;
+
+    AlignedBuffer() {}
+
+    explicit AlignedBuffer(size_t size) {
+        resize(size);
+    }
+
+    AlignedBuffer(const T* src, size_t size) {
+        resize(size);
+        if (size > 0) {
+            memcpy(mData, src, size * sizeof(T));
+        }
+    }
+
+    AlignedBuffer(const AlignedBuffer&) = delete;
+    AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+    AlignedBuffer(AlignedBuffer&& other) noexcept {
+        swap(other);
+    }
+
+    AlignedBuffer& operator=(AlignedBuffer&& other) noexcept {
+        swap(other);
+        return *this;
+    }
+
+    ~AlignedBuffer() {
+        Free(mData);
+    }
+
+    // Contents are zeroed, not preserved
+    void resize(size_t size) {
+        if (size > mCapacity) {
+            Free(mData);
+            mData = Allocate(size);
+            mCapacity = mData ? size : 0;
+        }
+        mSize = mData ? size : 0;
+        if (mSize > 0) {
+            memset(mData, 0, mSize * sizeof(T));
+        }
+    }
+
+    void clear() {
+        Free(mData);
+        mData = nullptr;
+        mSize = 0;
+        mCapacity = 0;
+    }
+
+    void swap(AlignedBuffer& other) noexcept {
+        std::swap(mData, other.mData);
+        std::swap(mSize, other.mSize);
+        std::swap(mCapacity, other.mCapacity);
+    }
+
+    T* data() { return mData; }
+    const T* data() const { return mData; }
+    size_t size() const { return mSize; }
+    bool empty() const { return mSize == 0; }
+    size_t GetBytes() const { return mCapacity * sizeof(T); }
+
+    T& operator[](size_t idx) { return mData[idx]; }
+    const T& operator[](size_t idx) const { return mData[idx]; }
+
+private:
+    static T* Allocate(size_t size) {
+        const size_t bytes = (size * sizeof(T) + kAlignment - 1) & ~(kAlignment - 1);
+#if defined(_WIN32)
+        return static_cast<T*>(_aligned_malloc(bytes, kAlignment));
+#else
+        void* ptr = nullptr;
+        if (posix_memalign(&ptr, kAlignment, bytes) != 0) { return nullptr; }
+        return static_cast<T*>(ptr);
+#endif
+    }
+
+    static void Free(T* ptr) {
+        if (ptr == nullptr) { return; }
+#if defined(_WIN32)
+        _aligned_free(ptr);
+#else
+        free(ptr);
+#endif
+    }
+
+    T* mData = nullptr;
+    size_t mSize = 0;
+    size_t mCapacity = 0;
+};
@@ -0,0 +1,470 @@
+#pragma once
+
+#include "MultichannelConvolver.h"
+#include "NonUniformConvolver.h"
+#include "HISSToolsConvolver.h"
+#include "TwoStageConvolver.h"
+#include "WDL_convolver.h"
+#include "RealFFT.h"
+#include "DirectConvolver.h"
+#include "MultirateStage.h"
+#include "DenormalGuard.h"
+#include "Report.h"
+#include "Noise.h"
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// Measures convolution engine throughput on synthetic IRs (decaying noise).
+// Every case renders kRenderSeconds of noise in kHostBlockSize blocks and
+// reports the processing time, so rows of one run can be compared. The
+// scheduling and denormal sections report per-block cost instead, where
+// spikes show. MultichannelConvolver's output is checked against
+// HISSToolsConvolver, shifted by its latency, wherever it runs.
+class ConvolverBenchmark {
+public:
+    ConvolverBenchmark() :
+        mIrSeconds({ 0.5, 2.0 }),
+        mLongIrSeconds({ 1.0, 5.0, 20.0 }),
+        mChannelCounts({ 2, 4, 8 })
+    {}
+
+    std::string Run() {
+        mReport.Clear();
+        mReport.Append("Convolver benchmark, %.0f Hz, %d sample host blocks, %.0f s rendered\n", kSampleRate, kHostBlockSize, kRenderSeconds);
+        RunChannelBatching();
+        RunMultirate();
+        RunFFT();
+        RunTiling();
+        RunScheduling();
+        RunDenormals();
+        return mReport.Get();
+    }
+
+private:
+    static constexpr double kSampleRate = 48000.;
+    static constexpr int kHostBlockSize = 256;
+    static constexpr double kRenderSeconds = 10.;
+    static constexpr double kBurstPeriod = 2.5;
+    static constexpr double kBurstLength = 0.05;
+    static constexpr int kSmallHostBlockSize = 64;
+    static constexpr int kSchedulingPasses = 3;
+    static constexpr size_t kMinFFTSize = 64;
+    static constexpr size_t kMaxFFTSize = 65536;
+    static constexpr size_t kFFTSamples = 1 << 22;   // per size and backend
+
+    // One MultichannelConvolver for all channels against one per channel
+    void RunChannelBatching() {
+        mReport.Append("\nChannel batching (MultichannelConvolver)\n");
+        mReport.Append("%8s %8s %12s %12s %8s %12s %12s\n", "IR s", "chans", "batched ms", "separate ms", "speedup", "max diff", "vs hiss");
+        for (double irSeconds : mIrSeconds) {
+            std::vector<float> ir = MakeIr(irSeconds, kSampleRate);
+            for (int numChannels : mChannelCounts) {
+                std::vector<std::vector<iplug::sample>> input = MakeInput(numChannels, (size_t)(kRenderSeconds * kSampleRate));
+                std::vector<std::vector<iplug::sample>> batchedOut, separateOut;
+                const std::vector<std::vector<iplug::sample>> reference = RenderReference(ir, input);
+
+                iplug::MultichannelConvolver batched(numChannels);
+                batched.SetIr(ir.data(), ir.size());
+                const double batchedMs = Render({ &batched }, input, batchedOut);
+
+                std::vector<std::unique_ptr<iplug::MultichannelConvolver>> engines;
+                std::vector<iplug::MultichannelConvolver*> separate;
+                for (int c = 0; c < numChannels; c++) {
+                    engines.push_back(std::make_unique<iplug::MultichannelConvolver>(1));
+                    engines.back()->SetIr(ir.data(), ir.size());
+                    separate.push_back(engines.back().get());
+                }
+                const double separateMs = Render(separate, input, separateOut);
+
+                mReport.Append("%8.1f %8d %12.1f %12.1f %8.2f %12.2e %12.2e\n", irSeconds, numChannels, batchedMs, separateMs,
+                    batchedMs > 0. ? separateMs / batchedMs : 0., MaxDifference(batchedOut, separateOut),
+                    MaxDifference(batchedOut, reference, batched.GetLatency()));
+            }
+        }
+    }
+
+    // Full rate convolution at high host rates against MultirateStage around an IR at 48 kHz
+    void RunMultirate() {
+        mReport.Append("\nMultirate (MultirateStage around a mono MultichannelConvolver)\n");
+        mReport.Append("%8s %8s %4s %12s %12s %8s %8s\n", "IR s", "host Hz", "D", "full ms", "multi ms", "speedup", "latency");
+        for (double irSeconds : mIrSeconds) {
+            for (double hostRate : { 96000., 192000. }) {
+                const int decimation = iplug::MultirateStage::GetDecimation(hostRate);
+                const size_t numSamples = (size_t)(kRenderSeconds * hostRate);
+                std::vector<iplug::sample> input = MakeInput(1, numSamples)[0];
+                std::vector<iplug::sample> output(numSamples);
+
+                std::vector<float> fullIr = MakeIr(irSeconds, hostRate);
+                iplug::MultichannelConvolver full(1);
+                full.SetIr(fullIr.data(), fullIr.size());
+                const double fullMs = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { full.process(in, out, n); }, input, output);
+
+                std::vector<float> reducedIr = MakeIr(irSeconds, hostRate / decimation);
+                iplug::MultichannelConvolver reduced(1);
+                reduced.SetIr(reducedIr.data(), reducedIr.size());
+                iplug::MultirateStage stage;
+                stage.OnReset(decimation);
+                stage.SetConvolverLatency(reduced.GetLatency());
+                const double multiMs = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { stage.process(reduced, in, out, n); }, input, output);
+
+                mReport.Append("%8.1f %8.0f %4d %12.1f %12.1f %8.2f %8d\n", irSeconds, hostRate, decimation, fullMs, multiMs,
+                    multiMs > 0. ? fullMs / multiMs : 0., stage.GetLatency() + reduced.GetLatency() * decimation);
+            }
+        }
+    }
+
+    // A forward and an inverse RealFFT per size and backend, best of three runs of kFFTSamples.
+    // The error is the largest bin difference to the reference backend relative to the largest bin.
+    void RunFFT() {
+        mReport.Append("\nFFT backends (us per forward + inverse, max relative error against the reference)\n");
+        mReport.Append("%8s", "size");
+        for (int b = 0; b < iplug::RealFFT::kNumBackends; b++) {
+            mReport.Append(" %10s %8s", iplug::RealFFT::GetBackendName((iplug::RealFFT::Backend)b), "error");
+        }
+        mReport.Append("\n");
+
+        for (size_t size = kMinFFTSize; size <= kMaxFFTSize; size *= 2) {
+            const std::vector<iplug::sample> noise = MakeInput(1, size)[0];
+            const std::vector<float> time(noise.begin(), noise.end());
+            std::vector<float> output(size);
+            std::vector<float> refRe(size / 2 + 1), refIm(size / 2 + 1);
+            std::vector<float> re(size / 2 + 1), im(size / 2 + 1);
+            iplug::RealFFT reference(iplug::RealFFT::kBackendReference);
+            reference.Init(size);
+            reference.Forward(time.data(), refRe.data(), refIm.data());
+            double peak = 0.;
+            for (size_t k = 0; k <= size / 2; k++) {
+                peak = std::max(peak, std::hypot((double)refRe[k], (double)refIm[k]));
+            }
+
+            mReport.Append("%8zu", size);
+            for (int b = 0; b < iplug::RealFFT::kNumBackends; b++) {
+                iplug::RealFFT fft((iplug::RealFFT::Backend)b);
+                if (fft.Init(size) != 0) {
+                    mReport.Append(" %10s %8s", "-", "-");
+                    continue;
+                }
+                const size_t iterations = std::max((size_t)1, kFFTSamples / size);
+                double best = 0.;
+                for (int run = 0; run < 3; run++) {
+                    auto start = std::chrono::steady_clock::now();
+                    for (size_t i = 0; i < iterations; i++) {
+                        fft.Forward(time.data(), re.data(), im.data());
+                        fft.Inverse(output.data(), re.data(), im.data());
+                    }
+                    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+                    best = run == 0 ? us : std::min(best, us);
+                }
+                fft.Forward(time.data(), re.data(), im.data());
+                double error = 0.;
+                for (size_t k = 0; k <= size / 2; k++) {
+                    error = std::max(error, std::hypot((double)(re[k] - refRe[k]), (double)(im[k] - refIm[k])));
+                }
+                mReport.Append(" %10.2f %8.1e", best, peak > 0. ? error / peak : 0.);
+            }
+            mReport.Append("\n");
+        }
+    }
+
+    // Long IRs: MultichannelConvolver with its bin-tiled spectra, with whole partitions
+    // one after the other, and the other engines, all mono
+    void RunTiling() {
+        mReport.Append("\nSpectrum layout (mono, MultichannelConvolver tiled / untiled against the other engines)\n");
+        mReport.Append("%8s %12s %12s %12s %12s %12s %12s %12s\n", "IR s", "tiled ms", "untiled ms", "hiss ms", "2stage ms", "wdl ms",
+            "tile diff", "vs hiss");
+        const size_t numSamples = (size_t)(kRenderSeconds * kSampleRate);
+        const std::vector<iplug::sample> input = MakeInput(1, numSamples)[0];
+        std::vector<iplug::sample> output(numSamples);
+
+        for (double irSeconds : mLongIrSeconds) {
+            const std::vector<float> ir = MakeIr(irSeconds, kSampleRate);
+            double ms[2];
+            std::vector<iplug::sample> multiOut[2];
+            int latency = 0;
+            for (int tiled = 1; tiled >= 0; tiled--) {
+                iplug::MultichannelConvolver multi(1);
+                multi.SetTiled(tiled != 0);
+                multi.SetIr(ir.data(), ir.size());
+                multiOut[tiled].resize(numSamples);
+                ms[tiled] = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { multi.process(in, out, n); }, input, multiOut[tiled]);
+                latency = multi.GetLatency();
+            }
+
+            iplug::HISSToolsConvolver hissTools;
+            hissTools.SetIr(ir.data(), ir.size());
+            const double hissMs = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { hissTools.process(in, out, n); }, input, output);
+            const std::vector<iplug::sample> hissOut = output;
+
+            iplug::TwoStageConvolver twoStage;
+            twoStage.OnReset(kSampleRate);
+            twoStage.SetIr(ir.data(), ir.size());
+            const double twoStageMs = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { twoStage.process(in, out, n); }, input, output);
+
+            iplug::WdlConvolver wdl(false);
+            wdl.SetIr(ir.data(), ir.size(), kSampleRate, kHostBlockSize);
+            const double wdlMs = RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { wdl.process(in, out, n); }, input, output);
+
+            mReport.Append("%8.1f %12.1f %12.1f %12.1f %12.1f %12.1f %12.2e %12.2e\n", irSeconds, ms[1], ms[0], hissMs, twoStageMs, wdlMs,
+                MaxDifference({ multiOut[1] }, { multiOut[0] }), MaxDifference({ multiOut[1] }, { hissOut }, latency));
+        }
+    }
+
+    // Worst against average block cost with all of a partition's work on the block that completes it,
+    // and with it spread over the host blocks in between. Both have the same latency. Each block's
+    // cost is its minimum over kSchedulingPasses fresh engines, which drops preemption spikes.
+    // The nu rows are NonUniformConvolver with HISSTools' and TwoStage's partition sizes, not those
+    // engines themselves: HISSToolsConvolver and TwoStageConvolver can't spread their work.
+    // nu auto is the layout AutoConvolver's multichannel backend runs, behind a direct head.
+    void RunScheduling() {
+        mReport.Append("\nScheduling (mono, %d sample host blocks, at block / spread)\n", kSmallHostBlockSize);
+        mReport.Append("%-12s %8s %12s %12s %8s %12s %12s %8s %12s %12s\n", "layout", "IR s", "at mean us", "at max us", "max/avg",
+            "sp mean us", "sp max us", "max/avg", "max diff", "vs hiss");
+        const size_t numSamples = (size_t)(kRenderSeconds * kSampleRate);
+        const std::vector<iplug::sample> input = MakeInput(1, numSamples)[0];
+        const std::vector<size_t> hissTools = { 64, 256, 1024, 4096 };
+        const std::vector<size_t> twoStage = { 128, 1024 };
+
+        for (double irSeconds : mIrSeconds) {
+            const std::vector<float> ir = MakeIr(irSeconds, kSampleRate);
+            const std::vector<iplug::sample> reference = RenderReference(ir, { input })[0];
+            MeasureScheduling("nu 64-4096", irSeconds, input, reference, [&ir, &hissTools](bool spread) {
+                auto engine = std::make_shared<iplug::NonUniformConvolver>(1, hissTools, spread);
+                engine->SetIr(ir.data(), ir.size());
+                return engine;
+            });
+            MeasureScheduling("nu 128-1024", irSeconds, input, reference, [&ir, &twoStage](bool spread) {
+                auto engine = std::make_shared<iplug::NonUniformConvolver>(1, twoStage, spread);
+                engine->SetIr(ir.data(), ir.size());
+                return engine;
+            });
+            MeasureScheduling("nu auto", irSeconds, input, reference, [&ir](bool spread) {
+                auto engine = std::make_shared<iplug::NonUniformConvolver>(1, iplug::NonUniformConvolver::MakeBlockSizes(64, 4096), spread, true);
+                engine->SetIr(ir.data(), ir.size());
+                return engine;
+            });
+            MeasureScheduling("multi", irSeconds, input, reference, [&ir](bool spread) {
+                auto engine = std::make_shared<iplug::MultichannelConvolver>(1, iplug::MultichannelConvolver::kDefaultBlockSize,
+                    spread ? iplug::MultichannelConvolver::kScheduleSpread : iplug::MultichannelConvolver::kScheduleAtBlock);
+                engine->SetIr(ir.data(), ir.size());
+                return engine;
+            });
+        }
+    }
+
+    // The spread output is also checked against the reference render
+    template <typename MakeEngine>
+    void MeasureScheduling(const char* name, double irSeconds, const std::vector<iplug::sample>& input, const std::vector<iplug::sample>& reference,
+        MakeEngine makeEngine) {
+        BlockCost cost[2];
+        std::vector<std::vector<iplug::sample>> output(2, std::vector<iplug::sample>(input.size()));
+        int latency = 0;
+        for (int spread = 0; spread < 2; spread++) {
+            std::vector<double> blockUs;
+            for (int pass = 0; pass < kSchedulingPasses; pass++) {
+                auto engine = makeEngine(spread != 0);
+                latency = engine->GetLatency();
+                auto process = [&engine](iplug::sample** in, iplug::sample** out, int n) { engine->process(in, out, n); };
+                const std::vector<double> passUs = TimeBlocks(process, input, output[spread], kSmallHostBlockSize);
+                if (pass == 0) {
+                    blockUs = passUs;
+                }
+                for (size_t i = 0; i < blockUs.size(); i++) {
+                    blockUs[i] = std::min(blockUs[i], passUs[i]);
+                }
+            }
+            cost[spread] = GetBlockCost(blockUs);
+        }
+        mReport.Append("%-12s %8.1f %12.1f %12.1f %8.1f %12.1f %12.1f %8.1f %12.2e %12.2e\n", name, irSeconds,
+            cost[0].meanUs, cost[0].maxUs, cost[0].GetRatio(), cost[1].meanUs, cost[1].maxUs, cost[1].GetRatio(),
+            MaxDifference({ output[0] }, { output[1] }), MaxDifference({ output[1] }, { reference }, latency));
+    }
+
+    // Per-block cost while IR tails decay far below the smallest normal float, without and with DenormalGuard
+    void RunDenormals() {
+        mReport.Append("\nDenormals (noise bursts every %.1f s, each followed by an IR tail decaying to 1e-42)\n", kBurstPeriod);
+        mReport.Append("%-8s %8s %14s %14s %14s %14s\n", "engine", "IR s", "off mean us", "off max us", "on mean us", "on max us");
+        const size_t numSamples = (size_t)(kRenderSeconds * kSampleRate);
+        std::vector<iplug::sample> input = MakeBursts(numSamples, kSampleRate);
+        std::vector<iplug::sample> output(numSamples);
+
+        for (double irSeconds : mIrSeconds) {
+            const std::vector<float> ir = MakeDecayingIr((size_t)(irSeconds * kSampleRate));
+            MeasureDenormals("multi", irSeconds, input, output, [&ir]() {
+                auto engine = std::make_shared<iplug::MultichannelConvolver>(1);
+                engine->SetIr(ir.data(), ir.size());
+                return [engine](iplug::sample** in, iplug::sample** out, int n) { engine->process(in, out, n); };
+            });
+        }
+
+        const std::vector<float> shortIr = MakeDecayingIr(iplug::DirectConvolver::kMaxLength);
+        MeasureDenormals("direct", shortIr.size() / kSampleRate, input, output, [&shortIr]() {
+            auto engine = std::make_shared<iplug::DirectConvolver>();
+            engine->SetIr(shortIr.data(), shortIr.size());
+            return [engine](iplug::sample** in, iplug::sample** out, int n) { engine->process(in, out, n); };
+        });
+    }
+
+    // A fresh engine per mode, so neither run starts from the other's state
+    template <typename MakeEngine>
+    void MeasureDenormals(const char* name, double irSeconds, const std::vector<iplug::sample>& input, std::vector<iplug::sample>& output,
+        MakeEngine makeEngine) {
+        BlockCost cost[2];
+        for (int flush = 0; flush < 2; flush++) {
+            auto process = makeEngine();
+            DenormalGuard denormalGuard(flush != 0);
+            cost[flush] = RenderBlocks(process, input, output);
+        }
+        mReport.Append("%-8s %8.3f %14.1f %14.1f %14.1f %14.1f\n", name, irSeconds, cost[0].meanUs, cost[0].maxUs, cost[1].meanUs, cost[1].maxUs);
+    }
+
+    struct BlockCost {
+        double meanUs = 0.;
+        double maxUs = 0.;
+
+        double GetRatio() const {
+            return meanUs > 0. ? maxUs / meanUs : 0.;
+        }
+    };
+
+    template <typename Process>
+    static BlockCost RenderBlocks(Process& process, const std::vector<iplug::sample>& input, std::vector<iplug::sample>& output) {
+        return GetBlockCost(TimeBlocks(process, input, output, kHostBlockSize));
+    }
+
+    // Microseconds per block
+    template <typename Process>
+    static std::vector<double> TimeBlocks(Process& process, const std::vector<iplug::sample>& input, std::vector<iplug::sample>& output,
+        int blockSize) {
+        std::vector<double> blockUs;
+        blockUs.reserve(input.size() / blockSize);
+        for (size_t pos = 0; pos + blockSize <= input.size(); pos += blockSize) {
+            iplug::sample* in = const_cast<iplug::sample*>(input.data()) + pos;
+            iplug::sample* out = output.data() + pos;
+            auto start = std::chrono::steady_clock::now();
+            process(&in, &out, blockSize);
+            blockUs.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        }
+        return blockUs;
+    }
+
+    static BlockCost GetBlockCost(const std::vector<double>& blockUs) {
+        BlockCost cost;
+        for (double us : blockUs) {
+            cost.meanUs += us;
+            cost.maxUs = std::max(cost.maxUs, us);
+        }
+        if (!blockUs.empty()) {
+            cost.meanUs /= blockUs.size();
+        }
+        return cost;
+    }
+
+    template <typename Process>
+    static double RenderMono(Process process, const std::vector<iplug::sample>& input, std::vector<iplug::sample>& output) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos + kHostBlockSize <= input.size(); pos += kHostBlockSize) {
+            iplug::sample* in = const_cast<iplug::sample*>(input.data()) + pos;
+            iplug::sample* out = output.data() + pos;
+            process(&in, &out, kHostBlockSize);
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // Each engine takes the next GetNumChannels() channels, returns milliseconds
+    static double Render(const std::vector<iplug::MultichannelConvolver*>& engines, const std::vector<std::vector<iplug::sample>>& input,
+        std::vector<std::vector<iplug::sample>>& output) {
+        output.assign(input.size(), std::vector<iplug::sample>(input[0].size()));
+        std::vector<iplug::sample*> inPtrs(input.size());
+        std::vector<iplug::sample*> outPtrs(input.size());
+
+        auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos + kHostBlockSize <= input[0].size(); pos += kHostBlockSize) {
+            for (size_t c = 0; c < input.size(); c++) {
+                inPtrs[c] = const_cast<iplug::sample*>(input[c].data()) + pos;
+                outPtrs[c] = output[c].data() + pos;
+            }
+            size_t channel = 0;
+            for (iplug::MultichannelConvolver* engine : engines) {
+                engine->process(&inPtrs[channel], &outPtrs[channel], kHostBlockSize);
+                channel += engine->GetNumChannels();
+            }
+        }
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    static std::vector<float> MakeIr(double seconds, double sampleRate) {
+        std::vector<float> ir((size_t)(seconds * sampleRate));
+        Noise noise(1);
+        for (size_t i = 0; i < ir.size(); i++) {
+            ir[i] = (float)(noise.Next() * exp(-6.9 * i / ir.size()));
+        }
+        return ir;
+    }
+
+    // Noise shaped to end at 1e-42, so the last few percent are float denormals
+    static std::vector<float> MakeDecayingIr(size_t length) {
+        std::vector<float> ir(length);
+        Noise noise(3);
+        for (size_t i = 0; i < ir.size(); i++) {
+            ir[i] = (float)(noise.Next() * exp(log(1e-42) * i / ir.size()));
+        }
+        return ir;
+    }
+
+    // kBurstLength of noise every kBurstPeriod, silence in between
+    static std::vector<iplug::sample> MakeBursts(size_t numSamples, double sampleRate) {
+        std::vector<iplug::sample> input(numSamples);
+        const size_t period = (size_t)(kBurstPeriod * sampleRate);
+        const size_t length = (size_t)(kBurstLength * sampleRate);
+        Noise noise(4);
+        for (size_t i = 0; i < numSamples; i++) {
+            input[i] = i % period < length ? (iplug::sample)noise.Next() : 0.;
+        }
+        return input;
+    }
+
+    static std::vector<std::vector<iplug::sample>> MakeInput(int numChannels, size_t numSamples) {
+        std::vector<std::vector<iplug::sample>> input(numChannels, std::vector<iplug::sample>(numSamples));
+        Noise noise(2);
+        for (std::vector<iplug::sample>& channel : input) {
+            for (iplug::sample& sample : channel) {
+                sample = (iplug::sample)noise.Next();
+            }
+        }
+        return input;
+    }
+
+    // One HISSToolsConvolver per channel, an engine none of ours shares code with
+    static std::vector<std::vector<iplug::sample>> RenderReference(const std::vector<float>& ir, const std::vector<std::vector<iplug::sample>>& input) {
+        std::vector<std::vector<iplug::sample>> output(input.size(), std::vector<iplug::sample>(input[0].size()));
+        for (size_t c = 0; c < input.size(); c++) {
+            iplug::HISSToolsConvolver hissTools;
+            hissTools.SetIr(ir.data(), ir.size());
+            RenderMono([&](iplug::sample** in, iplug::sample** out, int n) { hissTools.process(in, out, n); }, input[c], output[c]);
+        }
+        return output;
+    }
+
+    // Largest difference of a to b delayed by latency samples, for an engine's
+    // output against the zero latency reference
+    static double MaxDifference(const std::vector<std::vector<iplug::sample>>& a, const std::vector<std::vector<iplug::sample>>& b, int latency = 0) {
+        double difference = 0.;
+        for (size_t c = 0; c < a.size(); c++) {
+            for (size_t i = latency; i < a[c].size(); i++) {
+                difference = std::max(difference, (double)std::fabs(a[c][i] - b[c][i - latency]));
+            }
+        }
+        return difference;
+    }
+
+    std::vector<double> mIrSeconds;
+    std::vector<double> mLongIrSeconds;
+    std::vector<int> mChannelCounts;
+    Report mReport;
+};
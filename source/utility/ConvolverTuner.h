@@ -0,0 +1,372 @@
+#pragma once
+
+#include "HISSToolsConvolver.h"
+#include "TwoStageConvolver.h"
+#include "WDL_convolver.h"
+#include "DirectConvolver.h"
+#include "NonUniformConvolver.h"
+#include "PriorityJobQueue.h"
+#include "Trace.h"
+#include "Noise.h"
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Finds the fastest convolver configuration on this machine for a class of
+// IRs: the IR length rounded up to a power of two, the block size and the
+// sample rate. The first Lookup() of a class queues it on the
+// PriorityJobQueue, where every candidate renders a synthetic IR of that
+// length. Winners are kept in a profile file, so later sessions start with
+// them. Candidates with latency are never picked. Short classes also time
+// DirectConvolver, so the FIR/FFT crossover is measured per machine.
+// Every candidate renders a stereo pair, the mono engines as two
+// instances, so the multichannel layout (NonUniformConvolver with a
+// direct head and spread load, both channels in one engine) competes on
+// the work the plugin really does.
+class ConvolverTuner {
+public:
+    enum Backend {
+        kBackendHISSTools = 0,
+        kBackendTwoStage,
+        kBackendWdl,
+        kBackendDirect,
+        kBackendMultichannel,
+        kNumBackends
+    };
+
+    struct Config {
+        Backend backend = kBackendHISSTools;
+        int headBlockSize = 0;   // TwoStage partition sizes, the first and last of the multichannel layout
+        int tailBlockSize = 0;
+    };
+
+    // The tuner lives as long as some owner holds it, see ThreadPool::Get()
+    static std::shared_ptr<ConvolverTuner> Get() {
+        static std::mutex mutex;
+        static std::weak_ptr<ConvolverTuner> tuner;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<ConvolverTuner> shared = tuner.lock();
+        if (shared == nullptr) {
+            shared = std::shared_ptr<ConvolverTuner>(new ConvolverTuner());
+            tuner = shared;
+        }
+        return shared;
+    }
+
+    ~ConvolverTuner() {
+        mQuit = true;
+        mQueue->Remove(this);
+    }
+
+    // Reads <directory>/convolver-profile-stereo.txt, results are written back there.
+    // Every instance may call this, the profile is only read once. Profiles
+    // from before the stereo timing used another name and are tuned again.
+    void SetProfileDirectory(const std::string& directory) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        const std::string path = directory + "/convolver-profile-stereo.txt";
+        if (path == mProfilePath) { return; }
+        MakeDirectory(directory.c_str());
+        mProfilePath = path;
+        ReadProfile();
+    }
+
+    // True with the tuned configuration. Otherwise the class is queued for
+    // tuning and config is left at the default (HISSTools).
+    bool Lookup(size_t length, int blockSize, double sampleRate, Config& config) {
+        const Key key = MakeKey(length, blockSize, sampleRate);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mProfile.find(key);
+            if (it != mProfile.end()) {
+                config = it->second;
+                return true;
+            }
+            if (std::find(mPending.begin(), mPending.end(), key) == mPending.end()) {
+                mPending.push_back(key);
+            }
+        }
+        mQueue->Post(this);
+        return false;
+    }
+
+    bool IsTuned(size_t length, int blockSize, double sampleRate) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        return mProfile.count(MakeKey(length, blockSize, sampleRate)) > 0;
+    }
+
+    // Changes whenever a class was tuned, Lookup() again to pick up the result
+    uint64_t GetVersion() const {
+        return mVersion.load();
+    }
+
+    // Partition sizes of a multichannel config, see NonUniformConvolver::MakeBlockSizes()
+    static std::vector<size_t> GetMultichannelBlockSizes(const Config& config) {
+        return iplug::NonUniformConvolver::MakeBlockSizes((size_t)config.headBlockSize, (size_t)config.tailBlockSize);
+    }
+
+private:
+    // IRs are timed at 2^lengthClass samples
+    struct Key {
+        int lengthClass;
+        int blockSize;
+        int sampleRate;
+
+        bool operator<(const Key& other) const {
+            if (lengthClass != other.lengthClass) { return lengthClass < other.lengthClass; }
+            if (blockSize != other.blockSize) { return blockSize < other.blockSize; }
+            return sampleRate < other.sampleRate;
+        }
+
+        bool operator==(const Key& other) const {
+            return lengthClass == other.lengthClass && blockSize == other.blockSize && sampleRate == other.sampleRate;
+        }
+    };
+
+    static constexpr int kMinLengthClass = 7;
+    static constexpr double kRenderSeconds = 0.5;
+    static constexpr int kNumRuns = 3;
+
+    ConvolverTuner() :
+        mQueue(PriorityJobQueue::Get())
+    {
+        mQueue->Add(this, [this]() { RunJob(); });
+    }
+
+    static Key MakeKey(size_t length, int blockSize, double sampleRate) {
+        int lengthClass = kMinLengthClass;
+        while (((size_t)1 << lengthClass) < length) {
+            lengthClass++;
+        }
+        return { lengthClass, std::max(blockSize, 1), (int)std::lround(sampleRate) };
+    }
+
+    static std::vector<Config> GetCandidates(const Key& key) {
+        std::vector<Config> candidates;
+        if (((size_t)1 << key.lengthClass) <= iplug::DirectConvolver::kMaxLength) {
+            candidates.push_back({ kBackendDirect, 0, 0 });
+        }
+        candidates.push_back({ kBackendHISSTools, 0, 0 });
+        const int twoStageSizes[][2] = { { 64, 1024 }, { 128, 1024 }, { 128, 4096 }, { 256, 4096 } };
+        for (const auto& sizes : twoStageSizes) {
+            candidates.push_back({ kBackendTwoStage, sizes[0], sizes[1] });
+        }
+        candidates.push_back({ kBackendWdl, 0, 0 });
+        const int multichannelSizes[][2] = { { 64, 4096 }, { 128, 2048 } };
+        for (const auto& sizes : multichannelSizes) {
+            candidates.push_back({ kBackendMultichannel, sizes[0], sizes[1] });
+        }
+        return candidates;
+    }
+
+    // Tunes one class per pass until none are pending
+    void RunJob() {
+        while (!mQuit) {
+            Key key;
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                if (mPending.empty()) { return; }
+                key = mPending.front();
+            }
+
+            Config config;
+            const bool tuned = Tune(key, config);
+
+            std::lock_guard<std::mutex> lock(mMutex);
+            mPending.erase(std::find(mPending.begin(), mPending.end(), key));
+            if (tuned) {
+                mProfile[key] = config;
+                WriteProfile();
+                mVersion++;
+            }
+        }
+    }
+
+    // Keeps the candidate with the shortest render, best of kNumRuns each
+    bool Tune(const Key& key, Config& best) {
+        TRACE_SCOPE("ConvolverTuner::Tune");
+        const std::vector<float> ir = MakeIr((size_t)1 << key.lengthClass);
+        const int numBlocks = std::max((int)(kRenderSeconds * key.sampleRate / key.blockSize), 1);
+        std::vector<iplug::sample> input(2 * key.blockSize), output(2 * key.blockSize);
+        for (size_t i = 0; i < input.size(); i++) {
+            input[i] = (iplug::sample)((i * 7919 % 1000) * 0.001 - 0.5);
+        }
+
+        double bestSeconds = 0.;
+        bool found = false;
+        for (const Config& config : GetCandidates(key)) {
+            if (mQuit) { return false; }
+            double seconds = 0.;
+            if (!Time(config, key, ir, numBlocks, input, output, seconds)) { continue; }
+            if (!found || seconds < bestSeconds) {
+                best = config;
+                bestSeconds = seconds;
+                found = true;
+            }
+        }
+        return found;
+    }
+
+    bool Time(const Config& config, const Key& key, const std::vector<float>& ir, int numBlocks,
+        std::vector<iplug::sample>& input, std::vector<iplug::sample>& output, double& seconds) {
+        switch (config.backend) {
+        case kBackendTwoStage: {
+            iplug::TwoStageConvolver convolvers[2] = { { (size_t)config.headBlockSize, (size_t)config.tailBlockSize },
+                { (size_t)config.headBlockSize, (size_t)config.tailBlockSize } };
+            for (iplug::TwoStageConvolver& convolver : convolvers) {
+                convolver.OnReset((double)key.sampleRate);
+                if (convolver.SetIr(ir.data(), ir.size()) != 0) { return false; }
+            }
+            seconds = Render(convolvers, numBlocks, input, output);
+            return true;
+        }
+        case kBackendWdl: {
+            iplug::WdlConvolver convolvers[2] = { false, false };
+            for (iplug::WdlConvolver& convolver : convolvers) {
+                if (convolver.SetIr(ir.data(), ir.size(), (double)key.sampleRate, key.blockSize) != 0) { return false; }
+                if (convolver.GetLatency() > 0) { return false; }
+            }
+            seconds = Render(convolvers, numBlocks, input, output);
+            return true;
+        }
+        case kBackendDirect: {
+            iplug::DirectConvolver convolvers[2];
+            for (iplug::DirectConvolver& convolver : convolvers) {
+                if (convolver.SetIr(ir.data(), ir.size()) != 0) { return false; }
+            }
+            seconds = Render(convolvers, numBlocks, input, output);
+            return true;
+        }
+        case kBackendMultichannel: {
+            iplug::NonUniformConvolver convolver(2, GetMultichannelBlockSizes(config), true, true);
+            if (convolver.SetIr(ir.data(), ir.size()) != 0) { return false; }
+            if (convolver.GetLatency() > 0) { return false; }
+            seconds = Render(convolver, numBlocks, input, output);
+            return true;
+        }
+        default: {
+            iplug::HISSToolsConvolver convolvers[2];
+            for (iplug::HISSToolsConvolver& convolver : convolvers) {
+                if (convolver.SetIr(ir.data(), ir.size()) != CONVOLVE_ERR_NONE) { return false; }
+            }
+            seconds = Render(convolvers, numBlocks, input, output);
+            return true;
+        }
+        }
+    }
+
+    // A mono engine per channel
+    template <typename Convolver>
+    static void Process(Convolver (&convolvers)[2], iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        for (int c = 0; c < 2; c++) {
+            convolvers[c].process(inputs + c, outputs + c, nFrames);
+        }
+    }
+
+    template <typename Convolver>
+    static void Process(Convolver& convolver, iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+        convolver.process(inputs, outputs, nFrames);
+    }
+
+    // Best of kNumRuns stereo passes, the first one also fills the engines' input history
+    template <typename Convolvers>
+    static double Render(Convolvers& convolvers, int numBlocks, std::vector<iplug::sample>& input, std::vector<iplug::sample>& output) {
+        const int blockSize = (int)input.size() / 2;
+        double best = 0.;
+        for (int run = 0; run < kNumRuns; run++) {
+            auto start = std::chrono::steady_clock::now();
+            for (int b = 0; b < numBlocks; b++) {
+                iplug::sample* in[2] = { input.data(), input.data() + blockSize };
+                iplug::sample* out[2] = { output.data(), output.data() + blockSize };
+                Process(convolvers, in, out, blockSize);
+            }
+            const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best = run == 0 ? seconds : std::min(best, seconds);
+        }
+        return best;
+    }
+
+    // Decaying noise, see ConvolverBenchmark
+    static std::vector<float> MakeIr(size_t length) {
+        std::vector<float> ir(length);
+        Noise noise(1);
+        for (size_t i = 0; i < length; i++) {
+            ir[i] = (float)(noise.Next() * exp(-6.9 * i / length));
+        }
+        return ir;
+    }
+
+    static const char* GetBackendName(Backend backend) {
+        switch (backend) {
+        case kBackendTwoStage: return "twostage";
+        case kBackendWdl: return "wdl";
+        case kBackendDirect: return "direct";
+        case kBackendMultichannel: return "multichannel";
+        default: return "hisstools";
+        }
+    }
+
+    // One class per line: length class, block size, sample rate, backend, head and tail block size
+    void ReadProfile() {
+        FILE* f = fopen(mProfilePath.c_str(), "r");
+        if (f == nullptr) { return; }
+        Key key;
+        Config config;
+        char name[16];
+        while (fscanf(f, "%d %d %d %15s %d %d", &key.lengthClass, &key.blockSize, &key.sampleRate, name,
+            &config.headBlockSize, &config.tailBlockSize) == 6) {
+            config.backend = kNumBackends;
+            for (int b = 0; b < kNumBackends; b++) {
+                if (strcmp(name, GetBackendName((Backend)b)) == 0) {
+                    config.backend = (Backend)b;
+                }
+            }
+            if (config.backend != kNumBackends) {
+                mProfile[key] = config;
+            }
+        }
+        fclose(f);
+    }
+
+    void WriteProfile() {
+        if (mProfilePath.empty()) { return; }
+        FILE* f = fopen(mProfilePath.c_str(), "w");
+        if (f == nullptr) { return; }
+        for (const auto& entry : mProfile) {
+            fprintf(f, "%d %d %d %s %d %d\n", entry.first.lengthClass, entry.first.blockSize, entry.first.sampleRate,
+                GetBackendName(entry.second.backend), entry.second.headBlockSize, entry.second.tailBlockSize);
+        }
+        fclose(f);
+    }
+
+    static void MakeDirectory(const char* path) {
+#if defined(_WIN32)
+        _mkdir(path);
+#else
+        mkdir(path, 0755);
+#endif
+    }
+
+    std::shared_ptr<PriorityJobQueue> mQueue;
+    std::mutex mMutex;
+    std::map<Key, Config> mProfile;
+    std::vector<Key> mPending;
+    std::string mProfilePath;
+    std::atomic<uint64_t> mVersion{ 0 };
+    std::atomic<bool> mQuit{ false };
+};
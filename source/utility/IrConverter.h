@@ -0,0 +1,131 @@
+#pragma once
+
+#include "IrBuffer.h"
+#include "IrFile.h"
+#include "Report.h"
+#include "dirscan.h"
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+// Batch-builds NeZcab IR files from a WAV library. Every .wav in the folder
+// and its subfolders gets a <name>.<rate>.nzir next to it for each rate,
+// resampled like IrBuffer would. The default rates are the ones the
+// convolvers run at: 44.1 and 48 kHz, which MultirateStage also uses for
+// 88.2 kHz and up.
+class IrConverter {
+public:
+    IrConverter() :
+        mSampleRates({ 44100., 48000. })
+    {}
+
+    void SetSampleRates(const std::vector<double>& sampleRates) {
+        mSampleRates = sampleRates;
+    }
+
+    // Must match the plugin's resampler setting, other files are ignored on load
+    void SetResampler(IrBuffer::ResamplerType resamplerType) {
+        mResamplerType = resamplerType;
+    }
+
+    // Partition size of the stored spectra
+    void SetBlockSize(size_t blockSize) {
+        mBlockSize = blockSize;
+    }
+
+    // Returns the number of files that failed, 0 when all were converted
+    int Run(const char* directory) {
+        mReport.Clear();
+        mFailures = 0;
+        mConverted = 0;
+        mReport.Append("IR converter: %s\n\n", directory);
+        ConvertDirectory(directory);
+        mReport.Append("\n%d files written, %d failed\n", mConverted, mFailures);
+        return mFailures;
+    }
+
+    const std::string& GetReport() const {
+        return mReport.Get();
+    }
+
+private:
+    void ConvertDirectory(const std::string& directory) {
+        WDL_DirScan scan;
+        if (scan.First(directory.c_str())) { return; }
+        do {
+            const char* name = scan.GetCurrentFN();
+            if (name[0] == '.') { continue; }
+            WDL_String path;
+            scan.GetCurrentFullFN(&path);
+            if (scan.GetCurrentIsDirectory()) {
+                ConvertDirectory(path.Get());
+            }
+            else if (IsWav(name)) {
+                ConvertFile(path.Get());
+            }
+        } while (!scan.Next());
+    }
+
+    // One report line per written file, with where its time went
+    void ConvertFile(const char* path) {
+        IrBuffer::LoadStats stats;
+        double srcRate = 0.;
+        Clock::time_point start = Clock::now();
+        const uint64_t hash = IrBuffer::Registry::HashFile(path, &stats.fileBytes);
+        stats.openSeconds = SecondsSince(start);
+        std::shared_ptr<const IrBuffer::SourceSamples> source = IrBuffer::Decode(path, srcRate, stats);
+        if (source == nullptr) {
+            mReport.Append("%s: %s\n", path, IrBuffer::GetLoadErrorName(stats.error));
+            mFailures++;
+            return;
+        }
+
+        for (double sampleRate : mSampleRates) {
+            IrBuffer::IrSamples ir;
+            const std::string irPath = iplug::IrFile::MakePath(path, sampleRate);
+            start = Clock::now();
+            if (IrBuffer::Resample(source->data(), source->size(), srcRate, sampleRate, mResamplerType, ir) != 0) {
+                mReport.Append("%s: %s\n", irPath.c_str(), IrBuffer::GetLoadErrorName(IrBuffer::kLoadErrorResample));
+                mFailures++;
+                continue;
+            }
+            stats.resampleSeconds = SecondsSince(start);
+            start = Clock::now();
+            if (iplug::IrFile::Write(irPath.c_str(), ir.data(), ir.size(), sampleRate, (int)mResamplerType, hash, mBlockSize) != 0) {
+                mReport.Append("%s: can't write\n", irPath.c_str());
+                mFailures++;
+                continue;
+            }
+            const double writeSeconds = SecondsSince(start);
+            mReport.Append("%s: %zu samples, %zu KB in; ms: open %.1f, decode %.1f, resample %.1f, spectra and write %.1f\n",
+                irPath.c_str(), ir.size(), stats.fileBytes / 1024, 1000. * stats.openSeconds, 1000. * stats.decodeSeconds,
+                1000. * stats.resampleSeconds, 1000. * writeSeconds);
+            mConverted++;
+        }
+    }
+
+    static bool IsWav(const char* name) {
+        const size_t length = strlen(name);
+        if (length < 4) { return false; }
+        const char* extension = name + length - 4;
+        return extension[0] == '.' && tolower(extension[1]) == 'w' && tolower(extension[2]) == 'a' && tolower(extension[3]) == 'v';
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    static double SecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+    std::vector<double> mSampleRates;
+    IrBuffer::ResamplerType mResamplerType = IrBuffer::R8BRAIN_RESAMPLE;
+    size_t mBlockSize = iplug::MultichannelConvolver::kDefaultBlockSize;
+
+    Report mReport;
+    int mFailures = 0;
+    int mConverted = 0;
+};
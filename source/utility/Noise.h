@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstdint>
+
+// Seeded white noise for test signals and synthetic IRs. A plain LCG, so
+// every platform and build renders exactly the same samples.
+class Noise {
+public:
+    explicit Noise(uint32_t seed) :
+        mState(seed)
+    {}
+
+    // Uniform in [-0.5, 0.5)
+    double Next() {
+        mState = mState * 1664525u + 1013904223u;
+        return (mState >> 8) * (1. / 16777216.) - 0.5;
+    }
+
+private:
+    uint32_t mState;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+#include "DenormalGuard.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide queue for slow, non-realtime jobs such as building IRs.
+// Every owner registers one job function and then posts it whenever it
+// has work. Up to one worker per core runs the posted job with the highest
+// priority, oldest first among equals. An owner's job never runs twice at
+// once: posting while it runs queues it again for afterwards, posting while
+// it is queued only keeps it queued, so a burst of posts runs it once more.
+// A job can split its own work with RunParallel(), idle workers then help.
+class PriorityJobQueue {
+public:
+    // The queue lives as long as some owner holds it, see ThreadPool::Get()
+    static std::shared_ptr<PriorityJobQueue> Get() {
+        static std::mutex mutex;
+        static std::weak_ptr<PriorityJobQueue> queue;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        std::shared_ptr<PriorityJobQueue> shared = queue.lock();
+        if (shared == nullptr) {
+            shared = std::shared_ptr<PriorityJobQueue>(new PriorityJobQueue(GetDefaultNumWorkers()));
+            queue = shared;
+        }
+        return shared;
+    }
+
+    ~PriorityJobQueue() {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mCondition.notify_all();
+        for (std::thread& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    void Add(const void* owner, std::function<void()> job, int priority = 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        Entry& entry = mEntries[owner];
+        entry.job = std::move(job);
+        entry.priority = priority;
+    }
+
+    // Drops a queued job and waits for a running one, the owner can then be destroyed
+    void Remove(const void* owner) {
+        std::unique_lock<std::mutex> lock(mMutex);
+        auto it = mEntries.find(owner);
+        if (it == mEntries.end()) { return; }
+        it->second.queued = false;
+        mDone.wait(lock, [&it] { return !it->second.running; });
+        mEntries.erase(it);
+    }
+
+    // Doesn't allocate, so owners may post from the host's reset callback
+    void Post(const void* owner) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mEntries.find(owner);
+            if (it == mEntries.end() || it->second.queued) { return; }
+            it->second.queued = true;
+            it->second.sequence = mNextSequence++;
+        }
+        mCondition.notify_one();
+    }
+
+    // Takes effect for jobs that haven't started yet
+    void SetPriority(const void* owner, int priority) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = mEntries.find(owner);
+        if (it != mEntries.end()) {
+            it->second.priority = priority;
+        }
+    }
+
+    // Runs task(0) to task(count - 1) on the calling thread, while idle
+    // workers take indices too, and returns once all of them are done.
+    // It never waits for a worker, so a job may call it.
+    void RunParallel(size_t count, const std::function<void(size_t)>& task) {
+        Batch batch;
+        batch.task = &task;
+        batch.count = count;
+
+        std::unique_lock<std::mutex> lock(mMutex);
+        mBatches.push_back(&batch);
+        mCondition.notify_all();
+        while (RunBatchIndex(batch, lock)) {}
+
+        auto it = std::find(mBatches.begin(), mBatches.end(), &batch);
+        if (it != mBatches.end()) {
+            mBatches.erase(it);
+        }
+        mDone.wait(lock, [&batch] { return batch.running == 0; });
+    }
+
+    size_t GetNumWorkers() const {
+        return mThreads.size();
+    }
+
+private:
+    struct Entry {
+        std::function<void()> job;
+        int priority = 0;
+        uint64_t sequence = 0;
+        bool queued = false;
+        bool running = false;
+    };
+
+    struct Batch {
+        const std::function<void(size_t)>* task = nullptr;
+        size_t count = 0;
+        size_t next = 0;
+        size_t running = 0;
+    };
+
+    explicit PriorityJobQueue(size_t numWorkers) {
+        for (size_t i = 0; i < numWorkers; i++) {
+            mThreads.emplace_back(&PriorityJobQueue::WorkerLoop, this);
+        }
+    }
+
+    static size_t GetDefaultNumWorkers() {
+        const unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores : 1;
+    }
+
+    // Call with mMutex held
+    Entry* Next() {
+        Entry* next = nullptr;
+        for (auto& it : mEntries) {
+            Entry& entry = it.second;
+            if (!entry.queued || entry.running) { continue; }
+            if (next == nullptr || entry.priority > next->priority ||
+                (entry.priority == next->priority && entry.sequence < next->sequence)) {
+                next = &entry;
+            }
+        }
+        return next;
+    }
+
+    // Call with lock held on mMutex, runs the next index without it.
+    // False once every index was handed out.
+    bool RunBatchIndex(Batch& batch, std::unique_lock<std::mutex>& lock) {
+        if (batch.next == batch.count) { return false; }
+        const size_t index = batch.next++;
+        batch.running++;
+        lock.unlock();
+        (*batch.task)(index);
+        lock.lock();
+        if (--batch.running == 0) {
+            mDone.notify_all();
+        }
+        return true;
+    }
+
+    // Denormals are flushed here too, so the convolver tuner times engines as the audio thread runs them
+    void WorkerLoop() {
+        DenormalGuard denormalGuard;
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (true) {
+            Entry* entry = nullptr;
+            mCondition.wait(lock, [this, &entry] { return mQuit || !mBatches.empty() || (entry = Next()) != nullptr; });
+            if (mQuit) { return; }
+
+            // Splits of a running job come first, it already holds a worker.
+            // The owner outlives the batch while it is listed or running.
+            if (!mBatches.empty()) {
+                Batch* batch = mBatches.front();
+                if (!RunBatchIndex(*batch, lock) && !mBatches.empty() && mBatches.front() == batch) {
+                    mBatches.erase(mBatches.begin());
+                }
+                continue;
+            }
+
+            entry->queued = false;
+            entry->running = true;
+            lock.unlock();
+            entry->job();
+            lock.lock();
+            entry->running = false;
+
+            mDone.notify_all();
+            // A post that arrived while it ran was skipped by the other workers
+            if (entry->queued) {
+                mCondition.notify_one();
+            }
+        }
+    }
+
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::condition_variable mDone;
+    std::map<const void*, Entry> mEntries;
+    std::vector<Batch*> mBatches;
+    uint64_t mNextSequence = 0;
+    bool mQuit = false;
+    std::vector<std::thread> mThreads;
+};
@@ -0,0 +1,687 @@
+#pragma once
+
+#include "IrBuffer.h"
+#include "IAudioFile.h"
+#include "HISSToolsConvolver.h"
+#include "TwoStageConvolver.h"
+#include "WDL_convolver.h"
+#include "AutoConvolver.h"
+#include "OfflineConvolver.h"
+#include "DirectConvolver.h"
+#include "MultichannelConvolver.h"
+#include "NonUniformConvolver.h"
+#include "MultirateStage.h"
+#include "RealFFT.h"
+#include "Report.h"
+#include "Noise.h"
+#include <chrono>
+#include <complex>
+#include <map>
+#include <set>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(_WIN32)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Golden-output and performance regression check, run headless by
+// tests/RegressionMain.cpp (the NeZcab-tests project).
+// A fixed input is rendered through every convolver, resampler and sample
+// rate combination with the IR passed to Run(). Each render must match the
+// exact convolution of the input with the resampled IR, shifted by the
+// engine's latency. The engines are linear, so that pins them. Goldens in
+// goldenDir pin what it can't judge: every resampler's output at every
+// rate that differs from the IR's own, and MultirateStage's band split.
+// They hold the first kGoldenSeconds, a missing one fails its case.
+// At the IR's own rate no resampler runs, so the engines run once there.
+// At rates that run decimated, an identity IR through MultirateStage must
+// come out as the input delayed by exactly the latency it reports. Every
+// RealFFT backend must match the reference backend.
+// Throughput and worst block time are compared with the baseline recorded
+// on this machine, cases without one skip that check. SetRecord() writes
+// goldens and baselines.
+class RegressionSuite {
+public:
+    RegressionSuite() :
+        mSampleRates({ 44100., 48000., 96000. })
+    {}
+
+    void SetSampleRates(const std::vector<double>& sampleRates) {
+        mSampleRates = sampleRates;
+    }
+
+    // Allowed throughput loss (0.2 = 20% slower) and worst block time growth (1.0 = twice as long)
+    void SetPerformanceThresholds(double throughputLoss, double worstBlockGrowth) {
+        mThroughputLoss = throughputLoss;
+        mWorstBlockGrowth = worstBlockGrowth;
+    }
+
+    // Overwrites goldens and baselines with this run instead of comparing
+    void SetRecord(bool record) {
+        mRecord = record;
+    }
+
+    // Overwrites only the baselines, for a new machine with the committed goldens
+    void SetRecordBaselines(bool record) {
+        mRecordBaselines = record;
+    }
+
+    // Comma separated parts of case names, only matching cases run. Empty runs all.
+    void SetFilter(const std::string& filter) {
+        mFilter.clear();
+        size_t start = 0;
+        while (start <= filter.size()) {
+            const size_t end = std::min(filter.find(',', start), filter.size());
+            if (end > start) {
+                mFilter.push_back(filter.substr(start, end - start));
+            }
+            start = end + 1;
+        }
+    }
+
+    // Returns the number of failed checks, 0 when everything passed
+    int Run(const char* irPath, const char* goldenDir) {
+        mReport.Clear();
+        mFailures = 0;
+        mGoldenDir = goldenDir;
+        MakeDirectory(goldenDir);
+
+        HISSTools::IAudioFile file(irPath);
+        if (file.getIsError() || file.getFrames() == 0) {
+            mReport.Append("Can't read %s\n", irPath);
+            return ++mFailures;
+        }
+        std::vector<float> ir(file.getFrames());
+        file.readChannel(ir.data(), file.getFrames(), 0);
+        const double irRate = file.getSamplingRate();
+
+        ReadBaselines();
+        mReport.Append("Regression suite: %s\n\n", irPath);
+        mReport.Append("%-34s %8s %8s %10s %10s %10s  %s\n", "case", "ref dB", "gold dB", "x realtime", "worst us", "base us", "result");
+        RunFFTs();
+
+        mCheckedResamples.clear();
+        for (double sampleRate : mSampleRates) {
+            std::vector<float> inputs[2] = { MakeInput(sampleRate, 12345), MakeInput(sampleRate, 54321) };
+            const bool native = (int)sampleRate == (int)irRate;
+            for (int t = 0; t < IrBuffer::RESAMPLE_COUNT; t++) {
+                IrBuffer::IrSamples resampled;
+                if (!Resample(ir, irRate, sampleRate, t, resampled)) { continue; }
+                // Every resampler only copies at the IR's own rate
+                if (!native || t == 0) {
+                    RunEngines(native ? -1 : t, sampleRate, inputs, resampled);
+                }
+
+                const int decimation = iplug::MultirateStage::GetDecimation(sampleRate);
+                if (decimation > 1) {
+                    IrBuffer::IrSamples reduced;
+                    if (!Resample(ir, irRate, sampleRate / decimation, t, reduced)) { continue; }
+                    RunMultirate(t, sampleRate, decimation, inputs, reduced);
+                }
+            }
+            if (iplug::MultirateStage::GetDecimation(sampleRate) > 1) {
+                RunAlignment(sampleRate, inputs);
+            }
+        }
+
+        if (mRecord || mRecordBaselines) {
+            WriteBaselines();
+        }
+        mReport.Append("\n%d failure(s)\n", mFailures);
+        mReport.Append("ref dB: worst difference to the exact convolution relative to its peak, tolerance %.0f dB\n", kToleranceDb);
+        mReport.Append("        for the fft cases to the reference backend's spectra and inverse\n");
+        mReport.Append("gold dB: the same against the golden resampled IR or output, first %.2f s\n", kGoldenSeconds);
+        mReport.Append("x realtime: rendered audio time over processing time, at least %.0f%% of the baseline\n", 100. * (1. - mThroughputLoss));
+        mReport.Append("worst us: longest %d sample block, at most %.0f%% above the baseline\n", kBlockSize, 100. * mWorstBlockGrowth);
+        return mFailures;
+    }
+
+    const std::string& GetReport() const {
+        return mReport.Get();
+    }
+
+private:
+    struct Baseline {
+        double realtime = 0.;
+        double worstMicroseconds = 0.;
+    };
+
+    // A render of one case, channel 1 only for the stereo ones
+    struct Render {
+        std::vector<iplug::sample> out[2];
+        int numChannels = 1;
+        int latency = 0;
+        double realtime = 0.;
+        double worstMicroseconds = 0.;
+    };
+
+    // MultirateStage around an engine at the reduced rate, like the plugin runs it
+    template <typename Convolver>
+    struct MultirateChain {
+        template <typename... Args>
+        explicit MultirateChain(int decimation, Args&&... args) :
+            convolver(std::forward<Args>(args)...)
+        {
+            stage.OnReset(decimation);
+        }
+
+        void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+            stage.process(convolver, inputs, outputs, nFrames);
+        }
+
+        iplug::MultirateStage stage;
+        Convolver convolver;
+    };
+
+    // Both channels' stages around one stereo engine, like the plugin runs AutoConvolver
+    template <typename Convolver>
+    struct MultiratePair {
+        template <typename... Args>
+        explicit MultiratePair(int decimation, Args&&... args) :
+            convolver(std::forward<Args>(args)...)
+        {
+            stages[0].OnReset(decimation);
+            stages[1].OnReset(decimation);
+        }
+
+        void process(iplug::sample** inputs, iplug::sample** outputs, int nFrames) {
+            iplug::MultirateStage::ProcessPair(stages, convolver, inputs, outputs, nFrames);
+        }
+
+        iplug::MultirateStage stages[2];
+        Convolver convolver;
+    };
+
+    static constexpr int kBlockSize = 256;
+    static constexpr double kInputSeconds = 2.0;
+    static constexpr double kGoldenSeconds = 0.25;
+    static constexpr double kToleranceDb = -90.;
+    // Worst block times this short are timer noise and never fail
+    static constexpr double kMinWorstMicroseconds = 50.;
+
+    static const char* GetResamplerName(int type) {
+        switch (type) {
+        case IrBuffer::WDL_RESAMPLER: return "wdl";
+        case IrBuffer::CUSTOM_RESAMPLE: return "custom";
+        case IrBuffer::LINEAR_RESAMPLE: return "linear";
+        case IrBuffer::R8BRAIN_RESAMPLE: return "r8brain";
+        case IrBuffer::CUSTOM_HQ_RESAMPLE: return "custom-hq";
+        default: return "?";
+        }
+    }
+
+    // Resamples and checks the result against its golden once per resampler and rate.
+    // False when the resampler failed, which counts as a failure.
+    bool Resample(const std::vector<float>& ir, double irRate, double sampleRate, int resampler, IrBuffer::IrSamples& resampled) {
+        if (IrBuffer::Resample(ir.data(), ir.size(), irRate, sampleRate, (IrBuffer::ResamplerType)resampler, resampled) != 0) {
+            mReport.Append("%s %.0f resample failed\n", GetResamplerName(resampler), sampleRate);
+            mFailures++;
+            return false;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "resample-%s-%.0f", GetResamplerName(resampler), sampleRate);
+        if ((int)sampleRate == (int)irRate || !IsSelected(name) || !mCheckedResamples.insert(name).second) { return true; }
+
+        std::string result;
+        const std::vector<float> samples(resampled.data(), resampled.data() + resampled.size());
+        const double goldenDb = CompareGolden(name, sampleRate, samples, result);
+        mReport.Append("%-34s %8s %8s %10s %10s %10s  %s\n", name, "-", FormatDb(goldenDb).c_str(), "-", "-", "-",
+            result.empty() ? "ok" : result.c_str());
+        return true;
+    }
+
+    // Fixed pseudo-random bursts with silence in between, so tails are rendered too
+    static std::vector<float> MakeInput(double rate, uint32_t seed) {
+        std::vector<float> input((size_t)(kInputSeconds * rate));
+        const size_t burst = (size_t)(0.25 * rate);
+        Noise noise(seed);
+        for (size_t i = 0; i < input.size(); i++) {
+            const bool on = (i / burst) % 2 == 0;
+            input[i] = on ? (float)noise.Next() : 0.f;
+        }
+        input[0] = 1.f;
+        return input;
+    }
+
+    void RunEngines(int resampler, double sampleRate, const std::vector<float>* inputs, const IrBuffer::IrSamples& ir) {
+        const std::vector<float> expected = Convolve(inputs[0], ir.data(), ir.size());
+        const std::vector<float> expectedRight = Convolve(inputs[1], ir.data(), ir.size());
+        const size_t directLength = std::min(ir.size(), iplug::DirectConvolver::kMaxLength);
+        const std::vector<float> expectedDirect = Convolve(inputs[0], ir.data(), directLength);
+
+        RunCase("hisstools", resampler, sampleRate, inputs, ir.size(), 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::HISSToolsConvolver>();
+            return c->SetIr(ir.data(), ir.size()) == CONVOLVE_ERR_NONE ? std::move(c) : nullptr;
+        });
+        RunCase("twostage", resampler, sampleRate, inputs, ir.size(), 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::TwoStageConvolver>();
+            c->OnReset(sampleRate);
+            return c->SetIr(ir.data(), ir.size()) == 0 ? std::move(c) : nullptr;
+        });
+        RunCase("wdl", resampler, sampleRate, inputs, ir.size(), 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::WdlConvolver>();
+            if (c->SetIr(ir.data(), ir.size(), sampleRate, kBlockSize) != 0) { return std::unique_ptr<iplug::WdlConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        const std::vector<float> stereo[2] = { expected, expectedRight };
+        RunCase("auto", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::AutoConvolver>();
+            c->OnReset(sampleRate);
+            if (c->SetIr(ir.data(), ir.size(), sampleRate, kBlockSize) != 0) { return std::unique_ptr<iplug::AutoConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        RunCase("offline", resampler, sampleRate, inputs, ir.size(), 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::OfflineConvolver>();
+            if (c->SetIr(ir.data(), ir.size(), sampleRate) != 0) { return std::unique_ptr<iplug::OfflineConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        // Only takes short IRs, so it gets the IR's head
+        RunCase("direct", resampler, sampleRate, inputs, directLength, 1, &expectedDirect, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::DirectConvolver>();
+            return c->SetIr(ir.data(), directLength) == 0 ? std::move(c) : nullptr;
+        });
+        RunCase("multichannel", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::MultichannelConvolver>(2);
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::MultichannelConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        // The untiled layout and the other schedules
+        RunCase("multichannel-untiled", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::MultichannelConvolver>(2);
+            c->SetTiled(false);
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::MultichannelConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        RunCase("multichannel-atblock", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::MultichannelConvolver>(2, iplug::MultichannelConvolver::kDefaultBlockSize, iplug::MultichannelConvolver::kScheduleAtBlock);
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::MultichannelConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        RunCase("multichannel-deferred", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::MultichannelConvolver>(2, iplug::MultichannelConvolver::kDefaultBlockSize, iplug::MultichannelConvolver::kScheduleDeferred);
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::MultichannelConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        RunCase("nonuniform", resampler, sampleRate, inputs, ir.size(), 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::NonUniformConvolver>(1, std::vector<size_t>{ 64, 256, 1024, 4096 });
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::NonUniformConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+        // AutoConvolver's multichannel layout
+        RunCase("nonuniform-directhead", resampler, sampleRate, inputs, ir.size(), 2, stereo, false, [&](int& latency) {
+            auto c = std::make_unique<iplug::NonUniformConvolver>(2, iplug::NonUniformConvolver::MakeBlockSizes(64, 4096), true, true);
+            if (c->SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<iplug::NonUniformConvolver>(); }
+            latency = c->GetLatency();
+            return c;
+        });
+    }
+
+    // Golden only, the band split isn't a plain convolution
+    void RunMultirate(int resampler, double sampleRate, int decimation, const std::vector<float>* inputs, const IrBuffer::IrSamples& ir) {
+        RunCase("multirate", resampler, sampleRate, inputs, ir.size() * decimation, 1, nullptr, true, [&](int& latency) {
+            auto c = std::make_unique<MultirateChain<iplug::MultichannelConvolver>>(decimation, 1);
+            if (c->convolver.SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<MultirateChain<iplug::MultichannelConvolver>>(); }
+            c->stage.SetHighBandGain(iplug::MultirateStage::EstimateHighBandGain(ir.data(), ir.size()));
+            c->stage.SetConvolverLatency(c->convolver.GetLatency());
+            latency = c->stage.GetLatency() + decimation * c->convolver.GetLatency();
+            return c;
+        });
+        // Both channels through one engine
+        RunCase("multirate-pair", resampler, sampleRate, inputs, ir.size() * decimation, 2, nullptr, true, [&](int& latency) {
+            auto c = std::make_unique<MultiratePair<iplug::MultichannelConvolver>>(decimation, 2);
+            if (c->convolver.SetIr(ir.data(), ir.size()) != 0) { return std::unique_ptr<MultiratePair<iplug::MultichannelConvolver>>(); }
+            for (iplug::MultirateStage& stage : c->stages) {
+                stage.SetHighBandGain(iplug::MultirateStage::EstimateHighBandGain(ir.data(), ir.size()));
+                stage.SetConvolverLatency(c->convolver.GetLatency());
+            }
+            latency = c->stages[0].GetLatency() + decimation * c->convolver.GetLatency();
+            return c;
+        });
+    }
+
+    // Forward spectra of noise against the reference backend's, and the
+    // inverse of the reference spectra against the noise, 64 to 65536 points
+    void RunFFTs() {
+        for (int b = 0; b < iplug::RealFFT::kNumBackends; b++) {
+            const iplug::RealFFT::Backend backend = (iplug::RealFFT::Backend)b;
+            if (backend == iplug::RealFFT::kBackendReference) { continue; }
+            char name[64];
+            snprintf(name, sizeof(name), "fft-%s", iplug::RealFFT::GetBackendName(backend));
+            if (!IsSelected(name)) { continue; }
+
+            std::string result;
+            double errorDb = -INFINITY;
+            for (size_t size = 64; size <= 65536 && result.empty(); size *= 2) {
+                iplug::RealFFT reference(iplug::RealFFT::kBackendReference);
+                iplug::RealFFT fft(backend);
+                if (reference.Init(size) != 0 || fft.Init(size) != 0) {
+                    result += "init failed ";
+                    break;
+                }
+                const size_t numBins = size / 2 + 1;
+                std::vector<float> time(size), inverse(size);
+                std::vector<float> expected(2 * numBins), spectrum(2 * numBins);
+                Noise noise((uint32_t)size);
+                for (float& sample : time) {
+                    sample = (float)noise.Next();
+                }
+                reference.Forward(time.data(), expected.data(), expected.data() + numBins);
+                fft.Forward(time.data(), spectrum.data(), spectrum.data() + numBins);
+                fft.Inverse(inverse.data(), expected.data(), expected.data() + numBins);
+                errorDb = std::max(errorDb, ErrorDb(spectrum, 0, spectrum.size(), expected, 0));
+                errorDb = std::max(errorDb, ErrorDb(inverse, 0, inverse.size(), time, 0));
+            }
+            if (result.empty() && !(errorDb <= kToleranceDb)) {
+                result += "output wrong ";
+            }
+            if (!result.empty()) {
+                mFailures++;
+            }
+            mReport.Append("%-34s %8s %8s %10s %10s %10s  %s\n", name, FormatDb(errorDb).c_str(), "-", "-", "-", "-",
+                result.empty() ? "ok" : result.c_str());
+        }
+    }
+
+    // An identity IR with the whole band passed, so the output is the input
+    // delayed by the reported latency. Catches a high band that runs ahead of
+    // the convolved low band, like a convolver latency the stage didn't get.
+    void RunAlignment(double sampleRate, const std::vector<float>* inputs) {
+        const int decimation = iplug::MultirateStage::GetDecimation(sampleRate);
+        const double reducedRate = sampleRate / decimation;
+        const std::vector<float> identity = { 1.f };
+        const std::vector<float>& expected = inputs[0];
+
+        RunCase("aligned-offline", -1, sampleRate, inputs, 0, 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<MultirateChain<iplug::OfflineConvolver>>(decimation);
+            const WDL_FFT_REAL ir[1] = { 1. };
+            if (c->convolver.SetIr(ir, 1, reducedRate) != 0) { return std::unique_ptr<MultirateChain<iplug::OfflineConvolver>>(); }
+            c->stage.SetHighBandGain(1.f);
+            c->stage.SetConvolverLatency(c->convolver.GetLatency());
+            latency = c->stage.GetLatency() + decimation * c->convolver.GetLatency();
+            return c;
+        });
+        RunCase("aligned-multichannel", -1, sampleRate, inputs, 0, 1, &expected, false, [&](int& latency) {
+            auto c = std::make_unique<MultirateChain<iplug::MultichannelConvolver>>(decimation, 1);
+            if (c->convolver.SetIr(identity.data(), identity.size()) != 0) { return std::unique_ptr<MultirateChain<iplug::MultichannelConvolver>>(); }
+            c->stage.SetHighBandGain(1.f);
+            c->stage.SetConvolverLatency(c->convolver.GetLatency());
+            latency = c->stage.GetLatency() + decimation * c->convolver.GetLatency();
+            return c;
+        });
+    }
+
+    bool IsSelected(const std::string& name) const {
+        if (mFilter.empty()) { return true; }
+        for (const std::string& part : mFilter) {
+            if (name.find(part) != std::string::npos) { return true; }
+        }
+        return false;
+    }
+
+    // make builds the engine and sets its latency, nullptr when the IR is refused.
+    // expected holds one exact output per channel the engine renders, or is
+    // nullptr when there is none. A resampler below 0 is left out of the name.
+    template <typename Make>
+    void RunCase(const char* engine, int resampler, double sampleRate, const std::vector<float>* inputs, size_t irLength,
+        int numChannels, const std::vector<float>* expected, bool hasGolden, Make make) {
+        char name[64];
+        if (resampler < 0) {
+            snprintf(name, sizeof(name), "%s-%.0f", engine, sampleRate);
+        }
+        else {
+            snprintf(name, sizeof(name), "%s-%s-%.0f", engine, GetResamplerName(resampler), sampleRate);
+        }
+        if (!IsSelected(name)) { return; }
+
+        Render render;
+        render.numChannels = numChannels;
+        auto convolver = make(render.latency);
+        if (convolver == nullptr) {
+            mReport.Append("%-34s set IR failed\n", name);
+            mFailures++;
+            return;
+        }
+        Process(*convolver, inputs, inputs[0].size() + irLength + render.latency, sampleRate, render);
+
+        std::string result;
+        double referenceDb = NAN;
+        if (expected != nullptr) {
+            referenceDb = -INFINITY;
+            for (int c = 0; c < render.numChannels; c++) {
+                referenceDb = std::max(referenceDb, ErrorDb(render.out[c], 0, render.out[c].size(), expected[c], render.latency));
+            }
+            if (!(referenceDb <= kToleranceDb)) {
+                result += "output wrong ";
+                mFailures++;
+            }
+        }
+        double goldenDb = NAN;
+        if (hasGolden) {
+            const size_t length = std::min(render.out[0].size(), (size_t)(kGoldenSeconds * sampleRate));
+            goldenDb = CompareGolden(name, sampleRate, std::vector<float>(render.out[0].begin(), render.out[0].begin() + length), result);
+        }
+        const bool hasBaseline = CompareBaseline(name, render, result);
+        mReport.Append("%-34s %8s %8s %10.1f %10.1f %10s  %s\n", name, FormatDb(referenceDb).c_str(), FormatDb(goldenDb).c_str(),
+            render.realtime, render.worstMicroseconds, hasBaseline ? FormatMicroseconds(mBaselines[name].worstMicroseconds).c_str() : "-",
+            !result.empty() ? result.c_str() : hasBaseline ? "ok" : "ok, no baseline");
+    }
+
+    // "-" for checks that didn't run
+    static std::string FormatDb(double db) {
+        if (std::isnan(db)) { return "-"; }
+        char text[16];
+        snprintf(text, sizeof(text), "%.1f", db);
+        return text;
+    }
+
+    static std::string FormatMicroseconds(double microseconds) {
+        char text[16];
+        snprintf(text, sizeof(text), "%.1f", microseconds);
+        return text;
+    }
+
+    // Input followed by silence until length samples have been rendered, in fixed blocks
+    template <typename Convolver>
+    static void Process(Convolver& convolver, const std::vector<float>* inputs, size_t length, double sampleRate, Render& render) {
+        length = (length + 2 * kBlockSize - 1) / kBlockSize * kBlockSize;
+        std::vector<iplug::sample> in[2];
+        for (int c = 0; c < render.numChannels; c++) {
+            in[c].assign(length, 0.);
+            std::copy(inputs[c].begin(), inputs[c].end(), in[c].begin());
+            render.out[c].assign(length, 0.);
+        }
+
+        double worst = 0.;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t pos = 0; pos < length; pos += kBlockSize) {
+            iplug::sample* inPtrs[2] = { &in[0][pos], render.numChannels > 1 ? &in[1][pos] : nullptr };
+            iplug::sample* outPtrs[2] = { &render.out[0][pos], render.numChannels > 1 ? &render.out[1][pos] : nullptr };
+            auto blockStart = std::chrono::steady_clock::now();
+            convolver.process(inPtrs, outPtrs, kBlockSize);
+            worst = std::max(worst, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - blockStart).count());
+        }
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        render.realtime = seconds > 0. ? (length / sampleRate) / seconds : 0.;
+        render.worstMicroseconds = worst;
+    }
+
+    // Input convolved with the IR in one transform of RealFFT's double precision
+    // reference backend, the output every engine has to match
+    template <typename T>
+    static std::vector<float> Convolve(const std::vector<float>& input, const T* ir, size_t irLength) {
+        const size_t length = input.size() + irLength - 1;
+        size_t size = 16;
+        while (size < length) {
+            size *= 2;
+        }
+        iplug::RealFFT fft(iplug::RealFFT::kBackendReference);
+        if (fft.Init(size) != 0) { return std::vector<float>(); }
+
+        const size_t numBins = size / 2 + 1;
+        std::vector<float> time(size, 0.f);
+        std::vector<float> inRe(numBins), inIm(numBins), irRe(numBins), irIm(numBins);
+        std::copy(input.begin(), input.end(), time.begin());
+        fft.Forward(time.data(), inRe.data(), inIm.data());
+        std::fill(time.begin(), time.end(), 0.f);
+        for (size_t i = 0; i < irLength; i++) {
+            time[i] = (float)ir[i];
+        }
+        fft.Forward(time.data(), irRe.data(), irIm.data());
+
+        for (size_t k = 0; k < numBins; k++) {
+            const std::complex<double> product = std::complex<double>(inRe[k], inIm[k]) * std::complex<double>(irRe[k], irIm[k]);
+            inRe[k] = (float)product.real();
+            inIm[k] = (float)product.imag();
+        }
+        fft.Inverse(time.data(), inRe.data(), inIm.data());
+        time.resize(length);
+        return time;
+    }
+
+    // Worst difference of out[first, first + count) to expected delayed by
+    // offset samples, relative to the expected peak, in dB
+    template <typename T>
+    static double ErrorDb(const std::vector<T>& out, size_t first, size_t count, const std::vector<float>& expected, size_t offset) {
+        double peak = 0.;
+        double error = 0.;
+        for (size_t n = first; n < first + count && n < out.size(); n++) {
+            const double value = n >= offset && n - offset < expected.size() ? expected[n - offset] : 0.;
+            peak = std::max(peak, std::fabs(value));
+            error = std::max(error, std::fabs((double)out[n] - value));
+        }
+        return 20. * log10(std::max(error, 1e-30) / std::max(peak, 1e-30));
+    }
+
+    // The first kGoldenSeconds of samples against goldenDir/<name>.f32
+    double CompareGolden(const char* name, double sampleRate, std::vector<float> samples, std::string& result) {
+        const std::string path = mGoldenDir + "/" + name + ".f32";
+        const size_t length = std::min(samples.size(), (size_t)(kGoldenSeconds * sampleRate));
+        samples.resize(length);
+        if (mRecord) {
+            if (!WriteFloats(path, samples)) {
+                result += "can't write golden ";
+                mFailures++;
+            }
+            else {
+                result += "recorded ";
+            }
+            return NAN;
+        }
+
+        std::vector<float> golden;
+        if (!ReadFloats(path, golden)) {
+            result += "no golden ";
+            mFailures++;
+            return NAN;
+        }
+        if (golden.size() != length) {
+            result += "length changed ";
+            mFailures++;
+            return NAN;
+        }
+        const double errorDb = ErrorDb(samples, 0, length, golden, 0);
+        if (errorDb > kToleranceDb) {
+            result += "output changed ";
+            mFailures++;
+        }
+        return errorDb;
+    }
+
+    // False when this machine has no baseline for the case, its timings aren't checked then
+    bool CompareBaseline(const char* name, const Render& render, std::string& result) {
+        if (mRecord || mRecordBaselines) {
+            mBaselines[name] = Baseline{ render.realtime, render.worstMicroseconds };
+            return true;
+        }
+        auto it = mBaselines.find(name);
+        if (it == mBaselines.end()) { return false; }
+        const Baseline& baseline = it->second;
+        if (render.realtime < baseline.realtime * (1. - mThroughputLoss)) {
+            result += "slower ";
+            mFailures++;
+        }
+        if (render.worstMicroseconds > kMinWorstMicroseconds && render.worstMicroseconds > baseline.worstMicroseconds * (1. + mWorstBlockGrowth)) {
+            result += "worst block slower ";
+            mFailures++;
+        }
+        return true;
+    }
+
+    void ReadBaselines() {
+        mBaselines.clear();
+        FILE* f = fopen((mGoldenDir + "/baseline.txt").c_str(), "r");
+        if (f == nullptr) { return; }
+        char name[64];
+        Baseline baseline;
+        while (fscanf(f, "%63s %lf %lf", name, &baseline.realtime, &baseline.worstMicroseconds) == 3) {
+            mBaselines[name] = baseline;
+        }
+        fclose(f);
+    }
+
+    void WriteBaselines() {
+        FILE* f = fopen((mGoldenDir + "/baseline.txt").c_str(), "w");
+        if (f == nullptr) { return; }
+        for (const auto& entry : mBaselines) {
+            fprintf(f, "%s %.3f %.3f\n", entry.first.c_str(), entry.second.realtime, entry.second.worstMicroseconds);
+        }
+        fclose(f);
+    }
+
+    static bool ReadFloats(const std::string& path, std::vector<float>& data) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (f == nullptr) { return false; }
+        fseek(f, 0, SEEK_END);
+        const long bytes = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        data.resize(bytes > 0 ? bytes / sizeof(float) : 0);
+        const bool ok = fread(data.data(), sizeof(float), data.size(), f) == data.size();
+        fclose(f);
+        return ok;
+    }
+
+    static bool WriteFloats(const std::string& path, const std::vector<float>& data) {
+        FILE* f = fopen(path.c_str(), "wb");
+        if (f == nullptr) { return false; }
+        const bool ok = fwrite(data.data(), sizeof(float), data.size(), f) == data.size();
+        fclose(f);
+        return ok;
+    }
+
+    static void MakeDirectory(const char* path) {
+#if defined(_WIN32)
+        _mkdir(path);
+#else
+        mkdir(path, 0755);
+#endif
+    }
+
+    std::vector<double> mSampleRates;
+    std::vector<std::string> mFilter;
+    double mThroughputLoss = 0.2;
+    double mWorstBlockGrowth = 1.0;
+    bool mRecord = false;
+    bool mRecordBaselines = false;
+
+    std::string mGoldenDir;
+    std::map<std::string, Baseline> mBaselines;
+    std::set<std::string> mCheckedResamples;
+    Report mReport;
+    int mFailures = 0;
+};
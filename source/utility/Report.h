@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdarg>
+
+// Plain text report of the developer tools (benchmarks, regression suite,
+// IR converter), built up with printf-style lines
+class Report {
+public:
+    void Append(const char* format, ...) {
+        char line[512];
+        va_list args;
+        va_start(args, format);
+        const int length = vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        if (length < 0) { return; }
+        if (length < (int)sizeof(line)) {
+            mText += line;
+            return;
+        }
+
+        // Long paths don't fit, format again at full length
+        std::vector<char> longLine(length + 1);
+        va_start(args, format);
+        vsnprintf(longLine.data(), longLine.size(), format, args);
+        va_end(args);
+        mText += longLine.data();
+    }
+
+    void Clear() {
+        mText.clear();
+    }
+
+    const std::string& Get() const {
+        return mText;
+    }
+
+private:
+    std::string mText;
+};
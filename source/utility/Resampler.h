@@ -1,8 +1,13 @@
 
 #include <assert.h>
+#include <algorithm>
+#include <atomic>
 #include <vector>
+#include <functional>
+#include <memory>
 
 #include "AH_VectorOps.h"
+#include "PriorityJobQueue.h"
 
 // FIX - move correct mul factors back into max object/other places
 // FIX - add memory allocation issue handling and replace calls to malloc if possible
@@ -13,10 +18,31 @@ class Resampler
     
 public:
     
+    enum Interpolation
+    {
+        kInterpolateLinear,
+        kInterpolateCubic
+    };
+    
     Resampler()
     {
         setFilter(10, 16384, 0.455, 11.0);
     }
+    
+    // How arbitrary rates interpolate between the phases of the polyphase table (cubic costs twice as much)
+    
+    void setInterpolation(Interpolation interpolation)
+    {
+        mInterpolation = interpolation;
+    }
+    
+    // Long outputs are rendered in segments, by the caller and any idle queue workers - every output sample is
+    // computed on its own from the shared padded input, so the result is bit-identical to rendering on one thread
+    
+    void setJobQueue(std::shared_ptr<PriorityJobQueue> queue)
+    {
+        mQueue = queue;
+    }
 
 private:
 
@@ -129,101 +155,158 @@ private:
         return tempFilters;
     }
     
-    // This will be redundant if we use padding in the temp....
+    // Polyphase table for arbitrary rates: kNumPhases + 3 rows of float filters covering fractional positions
+    // -1 / kNumPhases to (kNumPhases + 1) / kNumPhases, so that both linear and cubic interpolation have their neighbours
     
-    void safeSamples(float *outBuffer, float *inBuffer, unsigned long inLength, long offset, long nSamps)
+    float *createPhaseFilters(double rate, long& filterLength, long& filterOffset)
     {
-        long tempOffset = 0;
-        long tempNSamps = nSamps;
-        long i;
+        double perSample = rate > 1.0 ? 1.0 / rate : 1.0;
+        double oneOverPerSample = rate > 1.0 ? mNumZeros * rate : mNumZeros;
+        double mul = rate < 1.0 ? rate : 1.0;
         
-        // Do not read before the buffer
+        filterOffset = (long) ceil(oneOverPerSample) + 1;
+        filterLength = filterOffset + (long) ceil(oneOverPerSample) + 2;
+        filterLength = (filterLength + 3) & ~3L;
         
-        if (offset < 0)
-        {
-            tempOffset = -offset;
-            tempNSamps -= tempOffset;
-            offset = 0;
-        }
+        float *phaseFilters = (float *) ALIGNED_MALLOC((kNumPhases + 3) * filterLength * sizeof(float));
+        float *currentFilter = phaseFilters;
         
-        if (tempNSamps < 0)
+        for (long i = -1; i <= kNumPhases + 1; i++, currentFilter += filterLength)
         {
-            tempNSamps = 0;
-            tempOffset = nSamps;
+            double fract = (double) i / (double) kNumPhases;
+            
+            for (long j = 0; j < filterLength; j++)
+            {
+                double filterPosition = fabs(perSample * (j - fract - filterOffset));
+                currentFilter[j] = filterPosition <= mNumZeros ? (float) (mul * getFilterValue(filterPosition)) : 0.f;
+            }
         }
         
-        // Do not read beyond the buffer
-        
-        if (offset + tempNSamps > inLength)
-            tempNSamps = inLength - offset;
-        
-        if (tempNSamps < 0)
-            tempNSamps = 0;
-        
-        for (i = 0; i < tempOffset; i++)
-            outBuffer[i] = 0;
+        return phaseFilters;
+    }
+    
+    float applyPhaseScalar(const float *filter, const float *input, unsigned long nSamps)
+    {
+        float filterSum = 0.f;
         
-        for (i = 0; i < tempNSamps; i++)
-            outBuffer[i + tempOffset] = inBuffer[i + offset];
+        for (unsigned long i = 0; i < nSamps; i++)
+            filterSum += filter[i] * input[i];
         
-        for (i = tempOffset + tempNSamps; i < nSamps; i++)
-            outBuffer[i] = 0;
+        return filterSum;
     }
     
-    // Calculate one sample 
-
-    double calcSample(float *input, unsigned long inLength, float *samples, double position, double rate)
+    #ifdef TARGET_INTEL
+    inline float applyPhaseVector(const float *filter, const float *input, unsigned long nSamps)
     {
-        double filterPosition, sum, fract;
-        double perSample = rate > 1.0 ? 1.0 / (rate * mNumZeros) : 1.0 / mNumZeros;
-        double oneOverPerSample = rate > 1.0 ? mNumZeros * rate : mNumZeros;
-        long offset, nsamps, idx;
+        // N.B. - nSamps is a multiple of 4, two accumulators hide the add latency
         
-        idx = (long) position;
-        fract = position - idx;
-        sum = 0.0;
+        vFloat filterSum0 = float2vector(0.f);
+        vFloat filterSum1 = float2vector(0.f);
+        float results[4];
+        unsigned long i;
         
-        // Get samples
+        for (i = 0; i + 8 <= nSamps; i += 8)
+        {
+            filterSum0 = F32_VEC_ADD_OP(filterSum0, F32_VEC_MUL_OP(F32_VEC_ULOAD(filter + i), F32_VEC_ULOAD(input + i)));
+            filterSum1 = F32_VEC_ADD_OP(filterSum1, F32_VEC_MUL_OP(F32_VEC_ULOAD(filter + i + 4), F32_VEC_ULOAD(input + i + 4)));
+        }
+        if (i < nSamps)
+            filterSum0 = F32_VEC_ADD_OP(filterSum0, F32_VEC_MUL_OP(F32_VEC_ULOAD(filter + i), F32_VEC_ULOAD(input + i)));
         
-        offset = position - oneOverPerSample;
-        nsamps = oneOverPerSample + oneOverPerSample + 2;
-        safeSamples(samples, input, inLength, offset, nsamps);
+        F32_VEC_USTORE(results, F32_VEC_ADD_OP(filterSum0, filterSum1));
         
-        // Get to first relevant sample
+        return (results[0] + results[1]) + (results[2] + results[3]);
+    }
+    #endif
+    
+    inline float applyPhase(const float *filter, const float *input, unsigned long nSamps)
+    {
+    #ifdef TARGET_INTEL
+        return applyPhaseVector(filter, input, nSamps);
+    #else
+        return applyPhaseScalar(filter, input, nSamps);
+    #endif
+    }
+    
+    // Arbitrary rates (no exact small ratio): the output at position i * rate interpolates between the
+    // neighbouring phases of the table, done on the filter outputs as the interpolation is linear in the coefficients
+    
+    float *resampleRate(float *input, unsigned long inLength, unsigned long nSamps, double rate, const std::function<bool()>& isCancelled)
+    {
+        long filterOffset;
+        long filterLength;
         
-        for (filterPosition = (idx - offset + fract) * perSample; filterPosition > 1.0; filterPosition -= perSample)
-            samples++;
+        float *phaseFilters = createPhaseFilters(rate, filterLength, filterOffset);
         
-        // Do left wing of the filter
+        // Allocate memory
         
-        // N.B. - refactor this later for speed and/or different phases...
+        float *output = new float[nSamps];
+        std::vector<float> inputTemp(inLength + filterOffset + filterLength + 4, 0.f);
         
-        for (; filterPosition >= 0.0; filterPosition -= perSample)
-            sum += *samples++ * getFilterValue(filterPosition * mNumZeros);
+        // Copy a padded version of the buffer....
         
-        // Do right wing of the filter
+        memcpy(&inputTemp[0] + filterOffset, input, inLength * sizeof(float));
         
-        for (filterPosition = -filterPosition; filterPosition <= 1.0; filterPosition += perSample)
-            sum += *samples++ * getFilterValue(filterPosition * mNumZeros);
+        // Resample
         
-        return sum;
-    }
-
-    float *resampleRate(float *input, unsigned long inLength, double offset, unsigned long nSamps, double rate)
-    {
-        double oneOverPerSample = rate > 1.0 ? mNumZeros * rate : mNumZeros;
-        double mul = rate < 1.0 ? rate : 1.0;
-        long tempLength = oneOverPerSample + oneOverPerSample + 2.0;
+        std::atomic<bool> cancelled(false);
         
-        // Allocate memory
+        renderSegments(nSamps, 1, [&](unsigned long begin, unsigned long end)
+        {
+            for (unsigned long i = begin; i < end; i++)
+            {
+                // N.B. - a cancelled resample returns no output
+                
+                if (((i - begin) & 1023) == 0 && (cancelled.load(std::memory_order_relaxed) || (isCancelled && isCancelled())))
+                {
+                    cancelled.store(true, std::memory_order_relaxed);
+                    return;
+                }
+                
+                double position = i * rate;
+                unsigned long idx = (unsigned long) position;
+                double phase = (position - idx) * kNumPhases;
+                long phaseIdx = (long) phase;
+                float fract = (float) (phase - phaseIdx);
+                
+                // Row 0 is phase -1
+                
+                const float *filter = phaseFilters + (phaseIdx + 1) * filterLength;
+                const float *samples = &inputTemp[0] + idx;
+                
+                if (mInterpolation == kInterpolateCubic)
+                {
+                    // 4 point Lagrange over phases -1 to 2
+                    
+                    float ym1 = applyPhase(filter - filterLength, samples, filterLength);
+                    float y0 = applyPhase(filter, samples, filterLength);
+                    float y1 = applyPhase(filter + filterLength, samples, filterLength);
+                    float y2 = applyPhase(filter + 2 * filterLength, samples, filterLength);
+                    
+                    float fm1 = fract + 1.f;
+                    float f1 = fract - 1.f;
+                    float f2 = fract - 2.f;
+                    
+                    output[i] = (-fract * f1 * f2 * ym1 + 3.f * fm1 * f1 * f2 * y0 - 3.f * fm1 * fract * f2 * y1 + fm1 * fract * f1 * y2) * (1.f / 6.f);
+                }
+                else
+                {
+                    float y0 = applyPhase(filter, samples, filterLength);
+                    float y1 = applyPhase(filter + filterLength, samples, filterLength);
+                    
+                    output[i] = y0 + fract * (y1 - y0);
+                }
+            }
+        });
         
-        std::vector<float> temp(tempLength);
-        float *output = new float[nSamps];
+        if (cancelled)
+        {
+            ALIGNED_FREE(phaseFilters);
+            delete[] output;
+            return NULL;
+        }
         
-        // Resample
-            
-        for (unsigned long i = 0; i < nSamps; i++)
-            output[i] = mul * calcSample(input, inLength, &temp[0], offset + (i * rate), rate);
+        ALIGNED_FREE(phaseFilters);
         
         return output;
     }
@@ -277,7 +360,29 @@ private:
     }
     #endif
     
-    float *resampleRatio(float *input, unsigned long inLength, long nsamps, long num, long denom)
+    // Calls render over 0 to nSamps in ranges starting on multiples of alignment - the caller renders any range no worker took
+    
+    void renderSegments(unsigned long nSamps, unsigned long alignment, const std::function<void(unsigned long, unsigned long)>& render)
+    {
+        unsigned long numSegments = mQueue ? std::min(nSamps / kMinSegmentLength, (unsigned long) (4 * (mQueue->GetNumWorkers() + 1))) : 1;
+        
+        if (numSegments < 2)
+        {
+            render(0, nSamps);
+            return;
+        }
+        
+        unsigned long segmentLength = ((nSamps + numSegments - 1) / numSegments + alignment - 1) / alignment * alignment;
+        numSegments = (nSamps + segmentLength - 1) / segmentLength;
+        
+        mQueue->RunParallel(numSegments, [&](size_t i)
+        {
+            unsigned long begin = (unsigned long) i * segmentLength;
+            render(begin, std::min(begin + segmentLength, nSamps));
+        });
+    }
+    
+    float *resampleRatio(float *input, unsigned long inLength, long nsamps, long num, long denom, const std::function<bool()>& isCancelled)
     {
         long filterOffset;
         long filterLength;
@@ -297,22 +402,42 @@ private:
         memcpy(&inputTemp[0] + filterOffset, input, inLength * sizeof(float));
         memset(&inputTemp[0] + filterOffset + inLength, 0, (filterLength - filterOffset) * sizeof(float));
         
-        // Resample
+        // Resample - a segment starts on a multiple of denom, so on the first filter
         
-        for (unsigned long i = 0, currentOffset = 0; i < nsamps; currentOffset += num)
+        std::atomic<bool> cancelled(false);
+        
+        renderSegments(nsamps, denom, [&](unsigned long begin, unsigned long end)
         {
-            double *currentFilter = tempFilters;
-
-            for (unsigned long j = 0; i < nsamps && j < denom; i++, j++, currentFilter += filterLength)
+            for (unsigned long i = begin, currentOffset = (begin / denom) * num; i < end; currentOffset += num)
             {
-                long inputOffset = currentOffset + (j * num / denom);
+                double *currentFilter = tempFilters;
+                
+                if (cancelled.load(std::memory_order_relaxed) || (isCancelled && isCancelled()))
+                {
+                    cancelled.store(true, std::memory_order_relaxed);
+                    return;
+                }
                 
+                for (unsigned long j = 0; i < end && j < denom; i++, j++, currentFilter += filterLength)
+                {
+                    long inputOffset = currentOffset + (j * num / denom);
+                    
     #ifdef TARGET_INTEL
-                output[i] = applyFilterVector((vDouble *)currentFilter, &inputTemp[0] + inputOffset, filterLength);
+                    output[i] = applyFilterVector((vDouble *)currentFilter, &inputTemp[0] + inputOffset, filterLength);
     #else
-                output[i] = applyFilterScalar(currentFilter, &inputTemp[0] + inputOffset, filterLength);
+                    output[i] = applyFilterScalar(currentFilter, &inputTemp[0] + inputOffset, filterLength);
     #endif
+                }
             }
+        });
+        
+        // N.B. - a cancelled resample returns no output
+        
+        if (cancelled)
+        {
+            ALIGNED_FREE(tempFilters);
+            delete[] output;
+            return NULL;
         }
         
         // Set not in use free temp memory and return
@@ -322,7 +447,9 @@ private:
         return output;
     }
 
-    void rateAsRatio(double rate, unsigned long& numerator, unsigned long& denominator)
+    // Returns false when no ratio with a denominator below 1000 matches the rate (the closest one is still returned)
+    
+    bool rateAsRatio(double rate, unsigned long& numerator, unsigned long& denominator)
     {
         long Cf[256];
         
@@ -363,6 +490,8 @@ private:
                 
         numerator = num;
         denominator = denom;
+        
+        return fabs((double) num / (double) denom - fabs(rate)) <= fabs(rate) * 1e-12;
     }
 
     float *copyInput(float *input, unsigned long inLength, unsigned long& outLength)
@@ -378,7 +507,7 @@ private:
     
 public:
 
-    float *process(float *input, unsigned long inLength, unsigned long& outLength, double inSR, double outSR, double transposeRatio = 1.0)
+    float *process(float *input, unsigned long inLength, unsigned long& outLength, double inSR, double outSR, double transposeRatio = 1.0, const std::function<bool()>& isCancelled = nullptr)
     {
         unsigned long numerator, denominator;
         
@@ -386,22 +515,47 @@ public:
         
         double rate = fabs(transposeRatio * inSR / outSR);
     
-        // Resample
+        // Resample - exact small ratios use per-ratio filters, anything else (such as a transposition) the polyphase table
         
-        rateAsRatio(rate, numerator, denominator);
+        if (!rateAsRatio(rate, numerator, denominator))
+        {
+            outLength = ceil((double) inLength / rate);
+            
+            float *output = resampleRate(input, inLength, outLength, rate, isCancelled);
+            
+            if (!output)
+                outLength = 0;
+            
+            return output;
+        }
         
         if (numerator == 1 && denominator == 1)
             return copyInput(input, inLength, outLength);
         
         outLength = ceil(((double) denominator * (double) inLength) / (double) numerator);
         
-        return resampleRatio(input, inLength, outLength, numerator, denominator);
+        float *output = resampleRatio(input, inLength, outLength, numerator, denominator, isCancelled);
+        
+        if (!output)
+            outLength = 0;
+        
+        return output;
     }
     
 private:
     
+    // Phases per input sample of the arbitrary rate table
+    
+    static constexpr long kNumPhases = 1024;
+    
+    // Shortest output worth a segment of its own
+    
+    static constexpr unsigned long kMinSegmentLength = 16384;
+    
     std::vector<double> mFilter;
     long mNumZeros;
     long mNumPoints;
+    Interpolation mInterpolation = kInterpolateLinear;
+    std::shared_ptr<PriorityJobQueue> mQueue;
 };
 
@@ -0,0 +1,331 @@
+#pragma once
+
+#include "IrBuffer.h"
+#include "IAudioFile.h"
+#include "Report.h"
+#include "Noise.h"
+#include <chrono>
+#include <complex>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <cstdint>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Measures cost and accuracy of every IrBuffer::ResamplerType.
+// Synthetic IRs (impulse, exponential sweep, decaying noise burst) are
+// generated at the source rate of each rate pair, loaded files are
+// resampled from their own rate to every destination rate.
+class ResamplerBenchmark {
+public:
+    struct RatePair {
+        double srcRate;
+        double dstRate;
+    };
+
+    ResamplerBenchmark() :
+        mRatePairs({ { 44100., 48000. }, { 48000., 44100. }, { 44100., 88200. }, { 44100., 96000. },
+                     { 48000., 96000. }, { 96000., 48000. }, { 48000., 192000. }, { 192000., 44100. } })
+    {
+    }
+
+    static const char* GetResamplerName(IrBuffer::ResamplerType type) {
+        switch (type) {
+        case IrBuffer::WDL_RESAMPLER: return "WDL";
+        case IrBuffer::CUSTOM_RESAMPLE: return "Custom";
+        case IrBuffer::LINEAR_RESAMPLE: return "Linear";
+        case IrBuffer::R8BRAIN_RESAMPLE: return "R8Brain";
+        case IrBuffer::CUSTOM_HQ_RESAMPLE: return "Custom HQ";
+        default: return "?";
+        }
+    }
+
+    void SetRatePairs(const std::vector<RatePair>& ratePairs) {
+        mRatePairs = ratePairs;
+    }
+
+    int AddFile(const char* path) {
+        HISSTools::IAudioFile file(path);
+        if (file.getIsError()) {
+            return 1;
+        }
+        FileSignal signal;
+        signal.name = path;
+        signal.rate = file.getSamplingRate();
+        signal.data.resize(file.getFrames());
+        file.readChannel(signal.data.data(), file.getFrames(), 0);
+        mFiles.push_back(std::move(signal));
+        return 0;
+    }
+
+    // Runs everything and returns the report as text
+    std::string Run() {
+        mReport.Clear();
+        mReport.Append("Resampler benchmark\n\n");
+        mReport.Append("%-24s %8s %8s %-8s %10s %12s %8s\n", "signal", "src", "dst", "mode", "time ms", "peak mem KB", "len err");
+
+        for (const RatePair& pair : mRatePairs) {
+            std::vector<float> signals[3] = {
+                MakeImpulse(pair.srcRate),
+                MakeSweep(pair.srcRate),
+                MakeNoiseBurst(pair.srcRate)
+            };
+            const char* names[3] = { "impulse", "sweep", "noise burst" };
+            for (int s = 0; s < 3; s++) {
+                for (int t = 0; t < IrBuffer::RESAMPLE_COUNT; t++) {
+                    MeasureCost(names[s], signals[s], pair.srcRate, pair.dstRate, (IrBuffer::ResamplerType)t);
+                }
+            }
+        }
+
+        for (const FileSignal& file : mFiles) {
+            for (double dstRate : GetDestinationRates()) {
+                if (dstRate == file.rate) { continue; }
+                for (int t = 0; t < IrBuffer::RESAMPLE_COUNT; t++) {
+                    MeasureCost(GetFileName(file.name), file.data, file.rate, dstRate, (IrBuffer::ResamplerType)t);
+                }
+            }
+        }
+
+        mReport.Append("\n%8s %8s %-8s %12s %14s %12s\n", "src", "dst", "mode", "ripple dB", "rejection dB", "latency err");
+        for (const RatePair& pair : mRatePairs) {
+            for (int t = 0; t < IrBuffer::RESAMPLE_COUNT; t++) {
+                MeasureAccuracy(pair.srcRate, pair.dstRate, (IrBuffer::ResamplerType)t);
+            }
+        }
+
+        mReport.Append("\nripple: magnitude spread of the resampled impulse up to 0.8 x the lower Nyquist\n");
+        mReport.Append("rejection: aliasing (down) or imaging (up) rejection of a tone that must not pass\n");
+        mReport.Append("latency err: impulse peak offset from its ideal position, in output samples\n");
+        return mReport.Get();
+    }
+
+private:
+    struct FileSignal {
+        std::string name;
+        double rate = 0.;
+        std::vector<float> data;
+    };
+
+    static constexpr double kImpulseSeconds = 0.5;
+    static constexpr double kImpulsePosition = 0.1;
+    static constexpr double kSignalSeconds = 1.0;
+    static constexpr int kRippleBins = 512;
+    static constexpr int kAnalysisWindow = 4096;
+
+    std::vector<double> GetDestinationRates() const {
+        std::vector<double> rates;
+        for (const RatePair& pair : mRatePairs) {
+            bool found = false;
+            for (double rate : rates) { found |= (rate == pair.dstRate); }
+            if (!found) { rates.push_back(pair.dstRate); }
+        }
+        return rates;
+    }
+
+    static const char* GetFileName(const std::string& path) {
+        size_t pos = path.find_last_of("/\\");
+        return path.c_str() + (pos == std::string::npos ? 0 : pos + 1);
+    }
+
+    static std::vector<float> MakeImpulse(double rate) {
+        std::vector<float> signal((size_t)(kImpulseSeconds * rate), 0.f);
+        signal[(size_t)(kImpulsePosition * signal.size())] = 1.f;
+        return signal;
+    }
+
+    static std::vector<float> MakeSweep(double rate) {
+        std::vector<float> signal((size_t)(kSignalSeconds * rate));
+        const double f0 = 20.;
+        const double f1 = 0.45 * rate;
+        const double T = kSignalSeconds;
+        const double k = log(f1 / f0);
+        for (size_t i = 0; i < signal.size(); i++) {
+            double t = i / rate;
+            signal[i] = (float)sin(2. * M_PI * f0 * T / k * (exp(t * k / T) - 1.));
+        }
+        return signal;
+    }
+
+    static std::vector<float> MakeNoiseBurst(double rate) {
+        std::vector<float> signal((size_t)(kSignalSeconds * rate));
+        Noise noise(0x12345678);
+        for (size_t i = 0; i < signal.size(); i++) {
+            signal[i] = (float)(2. * noise.Next() * exp(-6.9 * i / signal.size()));
+        }
+        return signal;
+    }
+
+    static std::vector<float> MakeTone(double rate, double freq) {
+        std::vector<float> signal((size_t)(kSignalSeconds * rate));
+        for (size_t i = 0; i < signal.size(); i++) {
+            signal[i] = (float)sin(2. * M_PI * freq * i / rate);
+        }
+        return signal;
+    }
+
+    static size_t GetPeakResidentBytes() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+        return (size_t)usage.ru_maxrss;
+#else
+        return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+    }
+
+    // Peak memory is reported as growth of the process peak, so it only
+    // shows runs that pushed the peak higher than anything before them
+    void MeasureCost(const char* name, const std::vector<float>& signal, double srcRate, double dstRate, IrBuffer::ResamplerType type) {
+        IrBuffer::IrSamples out;
+        size_t peakBefore = GetPeakResidentBytes();
+        auto start = std::chrono::steady_clock::now();
+        int err = IrBuffer::Resample(signal.data(), signal.size(), srcRate, dstRate, type, out);
+        auto end = std::chrono::steady_clock::now();
+        size_t peakAfter = GetPeakResidentBytes();
+
+        if (err != 0) {
+            mReport.Append("%-24.24s %8.0f %8.0f %-8s failed\n", name, srcRate, dstRate, GetResamplerName(type));
+            return;
+        }
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        long expectedLength = lround(signal.size() * dstRate / srcRate);
+        mReport.Append("%-24.24s %8.0f %8.0f %-8s %10.3f %12zu %8ld\n", name, srcRate, dstRate, GetResamplerName(type), ms,
+            (peakAfter - peakBefore) / 1024, (long)out.size() - expectedLength);
+    }
+
+    void MeasureAccuracy(double srcRate, double dstRate, IrBuffer::ResamplerType type) {
+        double ripple = 0.;
+        double rejection = 0.;
+        double latency = 0.;
+
+        // Impulse response: passband ripple and peak position
+        std::vector<float> impulse = MakeImpulse(srcRate);
+        IrBuffer::IrSamples out;
+        if (IrBuffer::Resample(impulse.data(), impulse.size(), srcRate, dstRate, type, out) != 0 || out.empty()) {
+            mReport.Append("%8.0f %8.0f %-8s failed\n", srcRate, dstRate, GetResamplerName(type));
+            return;
+        }
+        size_t peak = 0;
+        for (size_t i = 1; i < out.size(); i++) {
+            if (fabs(out[i]) > fabs(out[peak])) { peak = i; }
+        }
+        double refined = (double)peak;
+        if (peak > 0 && peak + 1 < out.size()) {
+            double a = fabs(out[peak - 1]), b = fabs(out[peak]), c = fabs(out[peak + 1]);
+            double denom = a - 2. * b + c;
+            if (denom != 0.) { refined += 0.5 * (a - c) / denom; }
+        }
+        latency = refined - (double)(size_t)(kImpulsePosition * impulse.size()) * dstRate / srcRate;
+
+        size_t begin = peak > kAnalysisWindow ? peak - kAnalysisWindow : 0;
+        size_t end = std::min(out.size(), peak + kAnalysisWindow);
+        const double maxFreq = 0.4 * std::min(srcRate, dstRate);
+        double minDb = 1e300, maxDb = -1e300;
+        for (int k = 0; k < kRippleBins; k++) {
+            double freq = 20. + (maxFreq - 20.) * k / (kRippleBins - 1);
+            std::complex<double> sum = 0.;
+            for (size_t i = begin; i < end; i++) {
+                sum += (double)out[i] * std::polar(1., -2. * M_PI * freq * (double)(i - begin) / dstRate);
+            }
+            double db = 20. * log10(std::abs(sum) + 1e-30);
+            minDb = std::min(minDb, db);
+            maxDb = std::max(maxDb, db);
+        }
+        ripple = maxDb - minDb;
+
+        // Tone that must not make it through
+        if (dstRate < srcRate) {
+            double freq = std::min(0.5 * (0.5 * dstRate + 0.5 * srcRate), 0.95 * 0.5 * srcRate);
+            std::vector<float> tone = MakeTone(srcRate, freq);
+            out.clear();
+            IrBuffer::Resample(tone.data(), tone.size(), srcRate, dstRate, type, out);
+            rejection = 10. * log10(MeanSquare(tone, tone.size() / 4, tone.size() * 3 / 4) /
+                (MeanSquare(out, out.size() / 4, out.size() * 3 / 4) + 1e-30));
+        }
+        else if (dstRate > srcRate) {
+            std::vector<float> tone = MakeTone(srcRate, 0.4 * srcRate);
+            out.clear();
+            IrBuffer::Resample(tone.data(), tone.size(), srcRate, dstRate, type, out);
+            rejection = ImageRejection(out, dstRate, 0.5 * srcRate);
+        }
+
+        mReport.Append("%8.0f %8.0f %-8s %12.3f %14.1f %12.2f\n", srcRate, dstRate, GetResamplerName(type), ripple, rejection, latency);
+    }
+
+    template <typename T>
+    static double MeanSquare(const T& signal, size_t begin, size_t end) {
+        double sum = 0.;
+        for (size_t i = begin; i < end; i++) {
+            sum += (double)signal[i] * (double)signal[i];
+        }
+        return end > begin ? sum / (end - begin) : 0.;
+    }
+
+    // Energy below the source Nyquist relative to images above it
+    static double ImageRejection(const IrBuffer::IrSamples& out, double rate, double cutoff) {
+        size_t size = 1;
+        while (size * 2 <= out.size() / 2) { size *= 2; }
+        std::vector<std::complex<double>> spectrum(size);
+        size_t offset = (out.size() - size) / 2;
+        for (size_t i = 0; i < size; i++) {
+            double window = 0.5 - 0.5 * cos(2. * M_PI * i / size);
+            spectrum[i] = (double)out[offset + i] * window;
+        }
+        FFT(spectrum);
+
+        // Skip a few bins around the cutoff so window leakage is not counted as an image
+        size_t cutoffBin = (size_t)(cutoff / rate * size);
+        double passEnergy = 0., imageEnergy = 0.;
+        for (size_t i = 0; i <= size / 2; i++) {
+            double energy = std::norm(spectrum[i]);
+            if (i + 8 < cutoffBin) { passEnergy += energy; }
+            else if (i > cutoffBin + 8) { imageEnergy += energy; }
+        }
+        return 10. * log10((passEnergy + 1e-30) / (imageEnergy + 1e-30));
+    }
+
+    // Plain radix-2 reference FFT, size must be a power of two
+    static void FFT(std::vector<std::complex<double>>& data) {
+        const size_t n = data.size();
+        for (size_t i = 1, j = 0; i < n; i++) {
+            size_t bit = n >> 1;
+            for (; j & bit; bit >>= 1) { j ^= bit; }
+            j ^= bit;
+            if (i < j) { std::swap(data[i], data[j]); }
+        }
+        for (size_t length = 2; length <= n; length <<= 1) {
+            std::complex<double> step = std::polar(1., -2. * M_PI / length);
+            for (size_t i = 0; i < n; i += length) {
+                std::complex<double> w = 1.;
+                for (size_t j = 0; j < length / 2; j++) {
+                    std::complex<double> u = data[i + j];
+                    std::complex<double> v = data[i + j + length / 2] * w;
+                    data[i + j] = u + v;
+                    data[i + j + length / 2] = u - v;
+                    w *= step;
+                }
+            }
+        }
+    }
+
+    std::vector<RatePair> mRatePairs;
+    std::vector<FileSignal> mFiles;
+    Report mReport;
+};
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "DenormalGuard.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Process-wide work-stealing pool shared by every plugin instance.
+// One worker per core (less one for the host's audio thread), each with a
+// small fixed queue. Workers run their earliest-deadline task first and
+// steal from the other queues when their own is empty.
+//
+// Submit() and Wait() are safe on the audio thread: they never allocate,
+// queues are only try-locked, and a task that no worker has started by
+// the time its owner needs it is run inline by Wait().
+//
+// Only the convolvers' tail tasks run here. Long offline work (splitting an
+// IR resample) runs on PriorityJobQueue's workers, so it never occupies a
+// worker a tail task is waiting for.
+class ThreadPool {
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    class Task {
+    public:
+        Task() {}
+        Task(void (*function)(void*), void* context) :
+            mFunction(function),
+            mContext(context)
+        {}
+
+        void Set(void (*function)(void*), void* context) {
+            mFunction = function;
+            mContext = context;
+        }
+
+    private:
+        friend class ThreadPool;
+
+        enum State { kIdle, kQueued, kRunning, kDone };
+
+        // Whoever moves the task from queued to running runs it
+        bool Claim() {
+            int expected = kQueued;
+            return mState.compare_exchange_strong(expected, kRunning, std::memory_order_acq_rel);
+        }
+
+        void Run() {
+            mFunction(mContext);
+            mState.store(kDone, std::memory_order_release);
+        }
+
+        void (*mFunction)(void*) = nullptr;
+        void* mContext = nullptr;
+        // Stale queue entries of a resubmitted task are still compared, so this is atomic
+        std::atomic<Clock::rep> mDeadline{ 0 };
+        std::atomic<int> mState{ kIdle };
+    };
+
+    struct WorkerStats {
+        double utilisation = 0.;
+        uint64_t tasksRun = 0;
+        uint64_t tasksStolen = 0;
+    };
+
+    // The pool lives as long as some instance holds it, so its threads are
+    // never joined from a static destructor during library unload
+    static std::shared_ptr<ThreadPool> Get() {
+        std::lock_guard<std::mutex> lock(GetInstanceMutex());
+        std::shared_ptr<ThreadPool> shared = GetInstance().lock();
+        if (shared == nullptr) {
+            shared = std::shared_ptr<ThreadPool>(new ThreadPool(GetDefaultNumWorkers()));
+            GetInstance() = shared;
+        }
+        return shared;
+    }
+
+    // The pool if some instance holds it, without starting one
+    static std::shared_ptr<ThreadPool> Find() {
+        std::lock_guard<std::mutex> lock(GetInstanceMutex());
+        return GetInstance().lock();
+    }
+
+    ~ThreadPool() {
+        mQuit.store(true);
+        {
+            std::lock_guard<std::mutex> lock(mSleepMutex);
+        }
+        mSleepCondition.notify_all();
+        for (std::thread& thread : mThreads) {
+            thread.join();
+        }
+    }
+
+    // The task must stay alive until Wait() returns. If every queue is busy or full it runs right here.
+    void Submit(Task& task, Clock::time_point deadline) {
+        task.mDeadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+        task.mState.store(Task::kQueued, std::memory_order_release);
+
+        const size_t numWorkers = mWorkers.size();
+        const size_t first = mNextWorker.fetch_add(1, std::memory_order_relaxed) % numWorkers;
+        for (size_t i = 0; i < numWorkers; i++) {
+            if (mWorkers[(first + i) % numWorkers]->TryPush(&task)) {
+                mSleepCondition.notify_one();
+                return;
+            }
+        }
+        if (task.Claim()) {
+            task.Run();
+        }
+    }
+
+    // Returns once the task has run, running it inline if no worker got to it in time
+    void Wait(Task& task) {
+        if (task.Claim()) {
+            task.Run();
+        }
+        while (task.mState.load(std::memory_order_acquire) == Task::kRunning) {
+            std::this_thread::yield();
+        }
+    }
+
+    // Call before a task is destroyed, queues may still point at a task that Wait() ran inline
+    void Remove(Task& task) {
+        Wait(task);
+        for (auto& worker : mWorkers) {
+            worker->Remove(&task);
+        }
+    }
+
+    size_t GetNumWorkers() const {
+        return mWorkers.size();
+    }
+
+    // Utilisation is busy time over wall time since the last ResetStats()
+    std::vector<WorkerStats> GetStats() const {
+        const double elapsed = std::chrono::duration<double>(Clock::now() - mStatsStart.load()).count();
+        std::vector<WorkerStats> stats(mWorkers.size());
+        for (size_t i = 0; i < mWorkers.size(); i++) {
+            stats[i].utilisation = elapsed > 0. ? mWorkers[i]->busySeconds.load() / elapsed : 0.;
+            stats[i].tasksRun = mWorkers[i]->tasksRun.load();
+            stats[i].tasksStolen = mWorkers[i]->tasksStolen.load();
+        }
+        return stats;
+    }
+
+    void ResetStats() {
+        for (auto& worker : mWorkers) {
+            worker->busySeconds.store(0.);
+            worker->tasksRun.store(0);
+            worker->tasksStolen.store(0);
+        }
+        mStatsStart.store(Clock::now());
+    }
+
+private:
+    static constexpr size_t kQueueSize = 256;
+    // Submit() wakes a worker, this only bounds a missed wake-up
+    static constexpr int kIdleWaitMs = 5;
+
+    struct Worker {
+        bool TryPush(Task* task) {
+            std::unique_lock<std::mutex> lock(mutex, std::try_to_lock);
+            if (!lock.owns_lock() || count == kQueueSize) { return false; }
+            queue[(head + count) % kQueueSize] = task;
+            count++;
+            return true;
+        }
+
+        // Takes the earliest deadline, tasks already claimed by Wait() are dropped on the way
+        Task* Pop(bool blocking) {
+            std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+            if (blocking) {
+                lock.lock();
+            }
+            else if (!lock.try_lock()) {
+                return nullptr;
+            }
+
+            while (count > 0) {
+                size_t best = 0;
+                for (size_t i = 1; i < count; i++) {
+                    if (queue[(head + i) % kQueueSize]->mDeadline.load(std::memory_order_relaxed) <
+                        queue[(head + best) % kQueueSize]->mDeadline.load(std::memory_order_relaxed)) {
+                        best = i;
+                    }
+                }
+                Task* task = queue[(head + best) % kQueueSize];
+                queue[(head + best) % kQueueSize] = queue[head];
+                head = (head + 1) % kQueueSize;
+                count--;
+                if (task->Claim()) {
+                    return task;
+                }
+            }
+            return nullptr;
+        }
+
+        void Remove(Task* task) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < count;) {
+                if (queue[(head + i) % kQueueSize] == task) {
+                    queue[(head + i) % kQueueSize] = queue[head];
+                    head = (head + 1) % kQueueSize;
+                    count--;
+                    // Indices shifted down by one and the old head moved into the freed slot, which is now i - 1
+                    if (i > 0) { i--; }
+                    continue;
+                }
+                i++;
+            }
+        }
+
+        std::mutex mutex;
+        Task* queue[kQueueSize];
+        size_t head = 0;
+        size_t count = 0;
+
+        std::atomic<double> busySeconds{ 0. };
+        std::atomic<uint64_t> tasksRun{ 0 };
+        std::atomic<uint64_t> tasksStolen{ 0 };
+    };
+
+    explicit ThreadPool(size_t numWorkers) :
+        mStatsStart(Clock::now())
+    {
+        for (size_t i = 0; i < numWorkers; i++) {
+            mWorkers.push_back(std::make_unique<Worker>());
+        }
+        for (size_t i = 0; i < numWorkers; i++) {
+            mThreads.emplace_back(&ThreadPool::WorkerLoop, this, i);
+        }
+    }
+
+    static size_t GetDefaultNumWorkers() {
+        const unsigned int cores = std::thread::hardware_concurrency();
+        return cores > 2 ? cores - 1 : 1;
+    }
+
+    static std::mutex& GetInstanceMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::weak_ptr<ThreadPool>& GetInstance() {
+        static std::weak_ptr<ThreadPool> pool;
+        return pool;
+    }
+
+    // Tasks run with denormals flushed, like the audio thread that waits for them
+    void WorkerLoop(size_t index) {
+        DenormalGuard denormalGuard;
+        Worker& self = *mWorkers[index];
+        while (!mQuit.load()) {
+            bool stolen = false;
+            Task* task = self.Pop(true);
+            for (size_t i = 1; task == nullptr && i < mWorkers.size(); i++) {
+                task = mWorkers[(index + i) % mWorkers.size()]->Pop(false);
+                stolen = true;
+            }
+
+            if (task == nullptr) {
+                std::unique_lock<std::mutex> lock(mSleepMutex);
+                mSleepCondition.wait_for(lock, std::chrono::milliseconds(kIdleWaitMs));
+                continue;
+            }
+
+            const Clock::time_point start = Clock::now();
+            task->Run();
+            const double busy = std::chrono::duration<double>(Clock::now() - start).count();
+            self.busySeconds.store(self.busySeconds.load(std::memory_order_relaxed) + busy, std::memory_order_relaxed);
+            self.tasksRun.fetch_add(1, std::memory_order_relaxed);
+            if (stolen) {
+                self.tasksStolen.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::vector<std::thread> mThreads;
+    std::atomic<size_t> mNextWorker{ 0 };
+    std::atomic<bool> mQuit{ false };
+    std::mutex mSleepMutex;
+    std::condition_variable mSleepCondition;
+    std::atomic<Clock::time_point> mStatsStart;
+};
@@ -0,0 +1,122 @@
+#pragma once
+
+// Uncomment to record TRACE_SCOPE timings, export them with Trace::Write()
+// and open the file in chrome://tracing or https://ui.perfetto.dev
+//#define NEZCAB_TRACE
+
+#if defined(NEZCAB_TRACE)
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Records named scopes into one ring buffer per thread. Recording is lock
+// free and never allocates after a thread's first event, so scopes may sit
+// on the audio thread. Each ring keeps its newest kRingSize events, events
+// overwritten while Write() reads them may come out garbled.
+class Trace {
+public:
+    class Scope {
+    public:
+        explicit Scope(const char* name) :
+            mName(name),
+            mStart(Now())
+        {}
+
+        ~Scope() {
+            Record(mName, mStart, Now());
+        }
+
+    private:
+        const char* mName;
+        int64_t mStart;
+    };
+
+    // Writes every recorded event as Chrome trace-event JSON, returns 0 on success
+    static int Write(const char* path) {
+        FILE* f = fopen(path, "w");
+        if (f == nullptr) { return 1; }
+
+        fputs("{\"traceEvents\":[\n", f);
+        bool first = true;
+        std::lock_guard<std::mutex> lock(GetMutex());
+        for (const std::unique_ptr<Ring>& ring : GetRings()) {
+            const uint64_t count = ring->count.load(std::memory_order_acquire);
+            const uint64_t begin = count > kRingSize ? count - kRingSize : 0;
+            for (uint64_t i = begin; i < count; i++) {
+                const Event& event = ring->events[i & (kRingSize - 1)];
+                fprintf(f, "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    first ? "" : ",\n", event.name, ring->threadId, event.start / 1000., (event.end - event.start) / 1000.);
+                first = false;
+            }
+        }
+        fputs("\n]}\n", f);
+        fclose(f);
+        return 0;
+    }
+
+private:
+    static constexpr uint64_t kRingSize = 1 << 16;
+
+    struct Event {
+        const char* name;
+        int64_t start;
+        int64_t end;
+    };
+
+    struct Ring {
+        Event events[kRingSize];
+        std::atomic<uint64_t> count{ 0 };
+        int threadId = 0;
+    };
+
+    // Nanoseconds since the first traced event
+    static int64_t Now() {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // Single writer: only the owning thread touches its ring
+    static void Record(const char* name, int64_t start, int64_t end) {
+        Ring& ring = GetThreadRing();
+        const uint64_t index = ring.count.load(std::memory_order_relaxed);
+        ring.events[index & (kRingSize - 1)] = Event{ name, start, end };
+        ring.count.store(index + 1, std::memory_order_release);
+    }
+
+    // Rings outlive their threads so events of finished threads can still be written
+    static Ring& GetThreadRing() {
+        thread_local Ring* ring = nullptr;
+        if (ring == nullptr) {
+            std::lock_guard<std::mutex> lock(GetMutex());
+            GetRings().push_back(std::make_unique<Ring>());
+            ring = GetRings().back().get();
+            ring->threadId = (int)GetRings().size();
+        }
+        return *ring;
+    }
+
+    static std::mutex& GetMutex() {
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<std::unique_ptr<Ring>>& GetRings() {
+        static std::vector<std::unique_ptr<Ring>> rings;
+        return rings;
+    }
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Trace::Scope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name)
+
+#endif
@@ -0,0 +1,39 @@
+// Headless runner of RegressionSuite, built by projects/NeZcab-tests.vcxproj.
+//   NeZcab-tests [--record] [--record-baselines] [--filter a,b] [ir.wav [goldenDir]]
+// Without paths it uses the repo's IR and tests/golden, so run it from the
+// repo root. Prints the report and returns 1 when a check failed.
+
+#include "RegressionSuite.h"
+#include <cstdio>
+#include <cstring>
+
+int main(int argc, char* argv[])
+{
+    RegressionSuite suite;
+    const char* irPath = "09-250215_0133-glued.wav";
+    const char* goldenDir = "tests/golden";
+    int numPaths = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--record") == 0) {
+            suite.SetRecord(true);
+        }
+        else if (strcmp(argv[i], "--record-baselines") == 0) {
+            suite.SetRecordBaselines(true);
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            suite.SetFilter(argv[++i]);
+        }
+        else if (argv[i][0] != '-' && numPaths < 2) {
+            (numPaths++ == 0 ? irPath : goldenDir) = argv[i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--record] [--record-baselines] [--filter a,b] [ir.wav [goldenDir]]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    const int failures = suite.Run(irPath, goldenDir);
+    fputs(suite.GetReport().c_str(), stdout);
+    return failures == 0 ? 0 : 1;
+}